@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <omp.h>
+#include <sched.h>
+
+/* Thread placement (--pin-threads)
+ *
+ * OpenMP threads may migrate freely between cores, and on multi-socket machines a thread then works on caches and
+ * read buffers in the memory of another NUMA node. With --pin-threads, thread i of the team is bound to the i-th CPU
+ * the process may run on (so one socket is filled before the next), and every thread allocates and opens its own
+ * caches and files, so that their memory is placed on its node by the first touch.
+ */
+
+// CPUs the process may run on (e.g. as restricted by taskset or the batch system), in ascending order
+inline std::vector<int> allowedCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t        set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+    return cpus;
+}
+
+// Binds each thread of a team of nThreads to one CPU; the binding stays with the (reused) threads of later teams
+inline bool pinThreads(size_t const nThreads)
+{
+    std::vector<int> const cpus = allowedCpus();
+    if (cpus.empty())
+        return false;
+
+    bool pinned = true;
+#pragma omp parallel num_threads(nThreads) reduction(&& : pinned)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &set);
+        pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+    return pinned;
+}
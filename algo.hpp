@@ -9,7 +9,11 @@
 #include <set>
 #include <span>
 #include <string>
+#include <string_view>
 #include <time.h>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <seqan/align.h>
@@ -23,8 +27,16 @@
 #include <seqan/stream.h>
 #include <seqan/vcf_io.h>
 
+#include "align_kernel.hpp"
+#include "alloc_stats.hpp"
+#include "bai.hpp"
+#include "contig_table.hpp"
+#include "evidence.hpp"
+#include "log.hpp"
 #include "misc.hpp"
 #include "options.hpp"
+#include "prefetch.hpp"
+#include "score_cache.hpp"
 
 // Sequence, alignment, and alignment row.
 typedef seqan::String<seqan::Dna5>                TSequence;
@@ -39,6 +51,12 @@ using TSeqInfix = seqan::Segment<TSequence const, seqan::InfixSegment>;
 
 inline constexpr size_t NO_BEST = size_t(-1ull);
 
+// Alignment scores at or below this are treated like NO_ALIGNMENT
+inline int32_t minAlignScore(size_t const wSizeActual)
+{
+    return static_cast<double>(wSizeActual) * 1.2;
+}
+
 /* Stores information of how a read aligns across a variant */
 class varAlignInfo
 {
@@ -116,7 +134,7 @@ public:
     {
         int    maxScore      = alignS[0];
         size_t maxI          = 0;
-        int    minAlignScore = static_cast<double>(wSizeActual) * 1.2;
+        int    minAlignScore = ::minAlignScore(wSizeActual);
 
         for (size_t i = 0; i < nAlleles; i++)
         {
@@ -144,8 +162,8 @@ public:
 
                 if (d > O.maxAlignBits)
                     d = O.maxAlignBits;
-                if (d < 0 && O.verbose)
-                    std::cerr << "WTF negative alignment score";
+                if (d < 0)
+                    LRC_DEBUG("WTF negative alignment score");
                 pref[i] += d;
             }
 
@@ -221,11 +239,11 @@ public:
 };
 
 /* Turns genotyping into std::string */
-void getGtString(std::vector<double> &       lls,
-                 std::vector<size_t> const & ads,
-                 std::vector<size_t> const & vas,
-                 std::vector<std::string> & va_reads,
-                 std::string &               gtString)
+void getGtString(std::vector<double> &            lls,
+                 std::vector<size_t> const &      ads,
+                 std::vector<size_t> const &      vas,
+                 std::vector<std::string> const & va_reads,
+                 std::string &                    gtString)
 {
     size_t gtLen = lls.size();
     for (size_t i = 0; i < gtLen; i++)
@@ -258,41 +276,26 @@ void getGtString(std::vector<double> &       lls,
             a2 = 0;
         }
     }
-    std::ostringstream buff;
-//    buff << maxA2 << "/" << maxA1 << ":";
-//    for (size_t i = 0; i < ads.size() - 1; i++)
-//        buff << ads[i] << ",";
-//    buff << ads[ads.size() - 1] << ":";
-//
-//    for (size_t i = 0; i < vas.size() - 1; i++)
-//        buff << vas[i] << ",";
-//    buff << vas[vas.size() - 1] << ":";
-//
-//    for (size_t i = 0; i < gtLen; i++)
-//    {
-//        double lp = (lls[i] - maxP) / LG10;
-//        if (lp < LL_THRESHOLD)
-//            lp = LL_THRESHOLD;
-//        buff << int(-10 * lp);
-//        if (i != gtLen - 1)
-//            buff << ",";
-//    }
-    buff << ":";
-    if (va_reads[0].empty()) {
-        buff <<".:";
-    }else {
-        buff << va_reads[0]<< ":";
-    }
-    if (va_reads[1].empty()) {
-        buff <<".";
-    }else {
-        buff << va_reads[1];
-    }
-    gtString = buff.str();
+
+    std::string_view const refReads = va_reads[0].empty() ? "." : va_reads[0];
+    std::string_view const altReads = va_reads[1].empty() ? "." : va_reads[1];
+
+    gtString.clear();
+    gtString.reserve(2 + refReads.size() + altReads.size());
+    gtString += ':';
+    gtString += refReads;
+    gtString += ':';
+    gtString += altReads;
 }
 
+// A genotyping model as a type, to select the instance of multiUpdateVC()
+template <genotyping_model gtm>
+inline constexpr std::integral_constant<genotyping_model, gtm> gt_model{};
+
 // Input: variant and seqan::VarAlignInfo records for each read overlapping variant
 // Output: Relative genotype likelihoods in log_2 scale and read info counts
+// The model is a template argument, so that the loop over the reads only contains its branch
+template <genotyping_model gtm>
 inline void multiUpdateVC(seqan::VcfRecord const &          var,
                           std::vector<varAlignInfo> const & vais,
                           std::vector<double> &             vC,
@@ -300,8 +303,7 @@ inline void multiUpdateVC(seqan::VcfRecord const &          var,
                           std::vector<size_t> &             VAs,
                           std::vector<std::string> &        VA_qnames,
                           size_t const                      wSizeActual,
-                          LRCOptions const &                O,
-                          genotyping_model const            gtm)
+                          LRCOptions const &                O)
 {
     seqan::StringSet<seqan::CharString> altSet;
     strSplit(altSet, var.alt, seqan::EqualsChar<','>());
@@ -321,18 +323,19 @@ inline void multiUpdateVC(seqan::VcfRecord const &          var,
         std::vector<double> prefs;
         prefs.resize(nAlts + 1);
         // read does not occur in bam file(s) 2 (insertion biased calls)
-        if (gtm == genotyping_model::ad || gtm == genotyping_model::joint)
+        if constexpr (gtm == genotyping_model::ad || gtm == genotyping_model::joint)
         {
             size_t bestI = vai.alignmentPreference(wSizeActual, O, prefs);
             if (bestI != NO_BEST) {
                 rI[bestI]++;
-                VA_qnames[bestI] = VA_qnames[bestI] + ","+vai.qname;
+                VA_qnames[bestI] += ',';
+                VA_qnames[bestI] += vai.qname;
             }
 
             rI[rI.size() - 1]++;
         }
 
-        if (gtm == genotyping_model::va || gtm == genotyping_model::joint)
+        if constexpr (gtm == genotyping_model::va || gtm == genotyping_model::joint)
         {
 //            if(vai.qname == "m64011_190901_095311/143853997/ccs") {
 //                int t = 9;
@@ -342,12 +345,11 @@ inline void multiUpdateVC(seqan::VcfRecord const &          var,
                 VAs[bestI]++;
             }
             VAs[VAs.size() - 1]++;
-            if (O.verbose)
-                std::cerr << "va " << /*TODO vai.first <<*/ " " << vai.nD << " " << vai.nI << " " << prefs[0] << " "
-                          << prefs[1] << " " << bestI << '\n';
+            LRC_DEBUG("va " << /*TODO vai.first <<*/ " " << vai.nD << " " << vai.nI << " " << prefs[0] << " "
+                            << prefs[1] << " " << bestI);
         }
 
-        if (gtm == genotyping_model::va_old)
+        if constexpr (gtm == genotyping_model::va_old)
         {
             size_t bestI     = 0;
             double bestScore = 0; // std::numeric_limits< float>::max();
@@ -365,12 +367,11 @@ inline void multiUpdateVC(seqan::VcfRecord const &          var,
             }
             VAs[bestI]++;
             VAs[VAs.size() - 1]++;
-            if (O.verbose)
-                std::cerr << "va_old " << /*TODO vai.first <<*/ " " << vai.nD << " " << vai.nI << " " << prefs[0] << " "
-                          << prefs[1] << " " << bestI << '\n';
+            LRC_DEBUG("va_old " << /*TODO vai.first <<*/ " " << vai.nD << " " << vai.nI << " " << prefs[0] << " "
+                                << prefs[1] << " " << bestI);
         }
 
-        if (gtm == genotyping_model::presence)
+        if constexpr (gtm == genotyping_model::presence)
         {
             if (vai.present(O))
             {
@@ -441,20 +442,20 @@ inline void multiUpdateVC(seqan::VcfRecord const &          var,
         }
     }
 
-    if (O.verbose)
-        std::cerr << "multiUpdateVC " << vC[0] << " " << vC[1] << " " << vC[2] << '\n';
+    LRC_DEBUG("multiUpdateVC " << vC[0] << " " << vC[1] << " " << vC[2]);
 }
 
 // Input: seqan::VcfRecord, reference and alternate reference
 // Output: Chrom and position of variant, ref sequence and alt sequence
 // TODO: Change this for a library that does this
-inline void getLocRefAlt(seqan::VcfRecord const &  variant,
-                         seqan::FaiIndex const &   faiI,
-                         seqan::CharString const & chrom,
-                         TSequence &               refSeq,
-                         std::vector<TSequence> &  altSeqs,
-                         size_t const              wSizeActual,
-                         LRCOptions const &        O)
+inline void getLocRefAlt(seqan::VcfRecord const &                   variant,
+                         seqan::FaiIndex const &                    faiI,
+                         uint32_t const                             idx, // ID of the contig in faiI
+                         [[maybe_unused]] seqan::CharString const & chrom,
+                         TSequence &                                refSeq,
+                         std::vector<TSequence> &                   altSeqs,
+                         size_t const                               wSizeActual,
+                         LRCOptions const &                         O)
 {
     TSequence                           ref = variant.ref;
     seqan::StringSet<seqan::CharString> altSet;
@@ -462,23 +463,14 @@ inline void getLocRefAlt(seqan::VcfRecord const &  variant,
 
     size_t nAlts = length(altSet);
 
-    int32_t  beginPos = variant.beginPos;
-    unsigned idx      = 0;
-
-    if (!getIdByName(idx, faiI, chrom))
-    {
-        if (O.verbose)
-            std::cerr << "rID " << chrom << " " << beginPos
-                      << " WARNING: reference FAI index has no entry for rID in Ref std::mapped.\n";
-    }
+    int32_t beginPos = variant.beginPos;
 //    beginPos = 181600000;
     if (O.genotypeRightBreakpoint)
         readRegion(refSeq, faiI, idx, beginPos - wSizeActual + length(ref), beginPos + length(ref) + wSizeActual);
     else
         readRegion(refSeq, faiI, idx, beginPos - wSizeActual, beginPos + wSizeActual);
 
-    if (O.verbose)
-        std::cerr << "refSeq " << refSeq << " " << chrom << " " << beginPos << std::endl;
+    LRC_DEBUG("refSeq " << refSeq << " " << chrom << " " << beginPos);
 
     std::vector<size_t> altLens;
     altLens.resize(nAlts);
@@ -526,20 +518,27 @@ inline void getLocRefAlt(seqan::VcfRecord const &  variant,
         }
     }
 
-    if (O.verbose)
-    {
-        std::cerr << "Printing altSeq " << '\n';
-        for (size_t i = 0; i < nAlts; i++)
-            std::cerr << "altSeq " << i << " " << altSeqs[i] << '\n';
-        std::cerr << "Done printing altSeq " << '\n';
-    }
+    LRC_DEBUG("Printing altSeq ");
+    for (size_t i = 0; i < nAlts; i++)
+        LRC_DEBUG("altSeq " << i << " " << altSeqs[i]);
+    LRC_DEBUG("Done printing altSeq ");
 }
 
+/* The options that decide the branches taken per read and per CIGAR operation. processChunk() and the functions it
+ * calls per read are instantiated for every combination, and chunkProcessor() selects the instance once per run.
+ */
+template <bool rightBreakpoint_, bool cropRead_>
+struct chunk_mode
+{
+    static constexpr bool rightBreakpoint = rightBreakpoint_; // --right_breakpoint
+    static constexpr bool cropRead        = cropRead_;        // --cropread
+};
+
 // Crops a subsequence in a seqan::BamAlignmentRecord and rewrites into the seqan::BamAlignmentRecord
+template <typename mode_t>
 inline void cropSeq(seqan::BamAlignmentRecord const & bar,
                     seqan::VcfRecord const &          var,
                     ssize_t const                     wSizeActual, // <- this is signed here!
-                    LRCOptions const &                O,
                     TSequence &                       croppedSeq)
 {
     auto &  cigarString    = bar.cigar;
@@ -553,7 +552,7 @@ inline void cropSeq(seqan::BamAlignmentRecord const & bar,
     // insert)
     // TODO the following can underflow :o
     ssize_t searchPos = var.beginPos - wSizeActual; // Want to change the search intervals for TRs
-    if (O.genotypeRightBreakpoint)
+    if constexpr (mode_t::rightBreakpoint)
         searchPos = var.beginPos + length(var.ref) + wSizeActual;
 
     searchPos = std::max<ssize_t>(searchPos, 0);
@@ -584,15 +583,14 @@ inline void cropSeq(seqan::BamAlignmentRecord const & bar,
                 std::cerr << "WARNING: cigar string case not accounted for \n";
         }
 
-        if (O.verbose)
-            std::cerr << bar.qName << " readpos " << alignPos << " " << var.beginPos << " " << searchPos << " "
-                      << cigarI << " " << readPos << " " << cigarString[cigarI].count << " " << cigarOperation << '\n';
+        LRC_TRACE(bar.qName << " readpos " << alignPos << " " << var.beginPos << " " << searchPos << " " << cigarI
+                            << " " << readPos << " " << cigarString[cigarI].count << " " << cigarOperation);
         cigarI++;
     }
-    if (alignPos < searchPos && O.verbose)
+    if (alignPos < searchPos)
     {
-        std::cerr << "Read clipped " << alignPos << " " << var.beginPos << " " << searchPos << " " << cigarI << " "
-                  << length(cigarString) << '\n';
+        LRC_DEBUG("Read clipped " << alignPos << " " << var.beginPos << " " << searchPos << " " << cigarI << " "
+                                  << length(cigarString));
     }
 
     if (cigarOperation == 'S' || cigarOperation == 'H')
@@ -600,7 +598,7 @@ inline void cropSeq(seqan::BamAlignmentRecord const & bar,
 
     ssize_t rBeg = 0;
     ssize_t rEnd = 0;
-    if (O.genotypeRightBreakpoint)
+    if constexpr (mode_t::rightBreakpoint)
     {
         //    if( alignPos >= searchPos ){
         //   rBeg = readPos - 2*wSizeActual;
@@ -616,9 +614,8 @@ inline void cropSeq(seqan::BamAlignmentRecord const & bar,
         {
             rBeg = readPos;
             rEnd = readPos + wSizeActual;
-            if (O.verbose)
-                std::cerr << "Insensible case for read " << bar.qName << " " << alignPos << " " << var.beginPos << " "
-                          << searchPos << " " << cigarI << " " << length(cigarString) << '\n';
+            LRC_DEBUG("Insensible case for read " << bar.qName << " " << alignPos << " " << var.beginPos << " "
+                                                  << searchPos << " " << cigarI << " " << length(cigarString));
         }
     }
     else
@@ -626,29 +623,27 @@ inline void cropSeq(seqan::BamAlignmentRecord const & bar,
         ssize_t rShift = alignPos - searchPos;
         rBeg           = readPos - rShift;
         rEnd           = readPos + 2 * wSizeActual - rShift;
-        if (rShift < 0 && O.verbose)
-            std::cerr << "Poorly formatted read, case not accounted for " << bar.qName << " " << alignPos << " "
-                      << var.beginPos << " " << searchPos << " " << cigarI << " " << length(cigarString) << '\n';
+        if (rShift < 0)
+            LRC_DEBUG("Poorly formatted read, case not accounted for " << bar.qName << " " << alignPos << " "
+                                                                       << var.beginPos << " " << searchPos << " "
+                                                                       << cigarI << " " << length(cigarString));
     }
-    if (O.verbose)
-        std::cerr << "Cropped read " << bar.qName << " " << alignPos << " " << var.beginPos << " " << searchPos << " "
-                  << cigarI << " " << length(cigarString) << " " << rBeg << " " << rEnd << '\n';
+    LRC_DEBUG("Cropped read " << bar.qName << " " << alignPos << " " << var.beginPos << " " << searchPos << " "
+                              << cigarI << " " << length(cigarString) << " " << rBeg << " " << rEnd);
     if (rBeg < 0)
         rBeg = 0;
     if (rEnd < 2 * wSizeActual)
         rEnd = 2 * wSizeActual;
     if (rEnd > (ssize_t)length(bar.seq))
         rEnd = (ssize_t)length(bar.seq);
-    if (O.verbose)
-        std::cerr << "ToInfix " << rBeg << " " << rEnd << " " << length(bar.seq) << '\n';
+    LRC_DEBUG("ToInfix " << rBeg << " " << rEnd << " " << length(bar.seq));
 //    a little bug here
     if (rEnd == rBeg) {
         rBeg = rBeg - 1;
     }
     croppedSeq = infixWithLength(bar.seq, rBeg, rEnd - rBeg);
 
-    if (O.verbose)
-        std::cerr << "Successful crop " << bar.qName << " " << croppedSeq << '\n';
+    LRC_DEBUG("Successful crop " << bar.qName << " " << croppedSeq);
 }
 
 template <typename TSeq>
@@ -664,16 +659,248 @@ inline TSeq mask(TSeq const & in)
     return ret;
 }
 
+/* The haplotypes that reads are aligned against, and everything derived from them that is the same for all reads */
+struct haplotype_set
+{
+    std::vector<TSeqInfix> seqs;          // the reference haplotype comes first
+    std::vector<uint64_t>  hashes;        // content hashes, only computed if the score cache is used
+    size_t                 maxLength = 0; // length of the longest haplotype
+    int32_t                vBand     = 0;
+    double                 bandScale = 1; // < 1 if the band was narrowed to stay within --max-cells-per-variant
+    int32_t                minScore  = 0; // scores at or below this are of no interest
+    bool                   useCache  = false;
+};
+
+// haplotypes needs to outlive the returned set
+inline haplotype_set makeHaplotypeSet(std::vector<TSequence> const & haplotypes,
+                                      size_t const                   wSizeActual,
+                                      score_cache const &            scoreCache,
+                                      LRCOptions const &             O)
+{
+    double const           band_fac = std::min<double>(O.bandedAlignmentPercent, 100.0) / 100.0;
+    alignment_scheme const scheme{O.match, O.mismatch, O.gapOpen, O.gapExtend};
+
+    haplotype_set ret;
+    for (TSequence const & hap : haplotypes)
+    {
+        ret.seqs.push_back(infix(hap, 0, seqan::length(hap)));
+        ret.maxLength = std::max<size_t>(ret.maxLength, seqan::length(hap));
+    }
+
+    ret.vBand    = static_cast<double>(seqan::length(haplotypes[0])) * band_fac;
+    ret.minScore = minAlignScore(wSizeActual);
+    ret.useCache = scoreCache.enabled() && scoreCache.scoringScheme() == scheme;
+
+    if (ret.useCache)
+        for (TSeqInfix const & seqV : ret.seqs)
+            ret.hashes.push_back(hashSequence(seqV));
+
+    return ret;
+}
+
+/* Aligns a read (window) against every haplotype of the set and writes the scores to alignS */
+inline void alignRead(TSequence const &     seqToAlign,
+                      haplotype_set const & haps,
+                      std::vector<double> & alignS,
+                      score_cache &         scoreCache,
+                      LRCOptions const &    O)
+{
+    seqan::Score<int32_t, seqan::Simple> scoringScheme32(O.match, O.mismatch, O.gapExtend, O.gapOpen);
+    seqan::Score<int16_t, seqan::Simple> scoringScheme16(O.match, O.mismatch, O.gapExtend, O.gapOpen);
+    alignment_scheme const               scheme{O.match, O.mismatch, O.gapOpen, O.gapExtend};
+
+    double const  band_fac = std::min<double>(O.bandedAlignmentPercent, 100.0) / 100.0 * haps.bandScale;
+    int32_t const vBand    = haps.vBand;
+    int32_t const hBand    = static_cast<double>(seqan::length(seqToAlign)) * band_fac;
+    int32_t const minScore = haps.minScore;
+    size_t const  nHaps    = haps.seqs.size();
+
+    uint64_t const readHash = haps.useCache ? hashSequence(seqToAlign) : 0;
+    if (haps.useCache)
+    {
+        // a single missing score means aligning the read against all haplotypes again
+        bool allCached = true;
+        for (size_t j = 0; j < nHaps && allCached; ++j)
+        {
+            std::optional<int32_t> score = scoreCache.find({readHash, haps.hashes[j], -vBand, +hBand, minScore});
+            allCached = score.has_value();
+            alignS[j] = score.value_or(NO_ALIGNMENT);
+        }
+
+        ++(allCached ? scoreCache.stats.hits : scoreCache.stats.misses);
+        if (allCached)
+            return;
+    }
+
+    // Reads that cannot score above minScore against any haplotype need not be aligned at all
+    if (maxLocalScore(seqan::length(seqToAlign), haps.maxLength, scheme) <= minScore)
+    {
+        for (size_t j = 0; j < nHaps; ++j)
+            alignS[j] = NO_ALIGNMENT;
+    }
+    // few, long pairs leave most SIMD lanes empty; vectorise within each pair instead
+    else if (selectAlignMode(nHaps, seqan::length(seqToAlign), seqan::length(haps.seqs[0])) ==
+             align_mode::intra_sequence)
+    {
+        // hopeless alignments (unrelated or mismapped reads) are abandoned early
+        for (size_t j = 0; j < nHaps; ++j)
+        {
+            std::optional<int32_t> score =
+              antidiagonalLocalScore(seqToAlign, haps.seqs[j], scheme, -vBand, +hBand, minScore);
+            alignS[j] = score ? *score : NO_ALIGNMENT;
+        }
+    }
+    else
+    {
+        // This is a set that contains the respective read at every position [needs to be same size as other set]
+        std::vector<TSeqInfix> seqsH(nHaps, infix(seqToAlign, 0, seqan::length(seqToAlign)));
+
+        seqan::ExecutionPolicy<seqan::Serial, seqan::Vectorial> execP;
+
+        if (seqan::length(haps.seqs[0]) > std::numeric_limits<int16_t>::max() &&
+            seqan::length(seqToAlign) > std::numeric_limits<int16_t>::max())
+        {
+            auto scores = seqan::localAlignmentScore(execP, seqsH, haps.seqs, scoringScheme32, -vBand, +hBand);
+
+            for (size_t j = 0; j < nHaps; ++j)
+                alignS[j] = scores[j];
+        }
+        else // this allows better vectorisation
+        {
+            auto scores = seqan::localAlignmentScore(execP, seqsH, haps.seqs, scoringScheme16, -vBand, +hBand);
+
+            for (size_t j = 0; j < nHaps; ++j)
+                alignS[j] = scores[j];
+        }
+    }
+
+    if (haps.useCache)
+        for (size_t j = 0; j < nHaps; ++j)
+            scoreCache.insert({readHash, haps.hashes[j], -vBand, +hBand, minScore}, alignS[j]);
+}
+
+/* Compute budget (--max-cells-per-variant)
+ *
+ * The DP cells of all alignments of a variant (or of a cluster) are estimated before aligning. Over budget, only every
+ * n-th read is aligned (down to BUDGET_MIN_READS), then the band is narrowed (down to BUDGET_MIN_BAND), and finally
+ * nothing is aligned at all. Reads that are not aligned only contribute their CIGAR evidence.
+ */
+enum class budget_level : uint8_t
+{
+    full,  // within budget
+    reads, // only a subset of the reads was aligned
+    band,  // a subset of the reads was aligned with a narrower band
+    cigar  // nothing was aligned
+};
+
+inline constexpr size_t BUDGET_MIN_READS = 16;
+inline constexpr double BUDGET_MIN_BAND  = 0.05; // fraction of the sequence lengths
+
+inline char const * budgetLevelName(budget_level const level)
+{
+    switch (level)
+    {
+        case budget_level::reads:
+            return "reads";
+        case budget_level::band:
+            return "band";
+        case budget_level::cigar:
+            return "cigar";
+        default:
+            return "full";
+    }
+}
+
+struct alignment_budget
+{
+    budget_level level      = budget_level::full;
+    size_t       readStride = 1; // every readStride-th read is aligned
+    double       bandScale  = 1;
+
+    bool aligns(size_t const read) const
+    {
+        return level != budget_level::cigar && read % readStride == 0;
+    }
+};
+
+// DP cells of aligning every stride-th read against all haplotypes, with the band scaled by bandScale
+inline double alignmentCells(std::vector<size_t> const & readLengths,
+                             haplotype_set const &       haps,
+                             size_t const                stride,
+                             double const                bandScale,
+                             LRCOptions const &          O)
+{
+    double const band_fac = std::min<double>(O.bandedAlignmentPercent, 100.0) / 100.0 * bandScale;
+
+    double cells = 0;
+    for (size_t i = 0; i < readLengths.size(); i += stride)
+    {
+        double const readLen = readLengths[i];
+        double const width   = haps.vBand * bandScale + readLen * band_fac + 1;
+        for (TSeqInfix const & hap : haps.seqs)
+        {
+            double const hapLen = seqan::length(hap);
+            cells += std::min(readLen * hapLen, std::min(readLen, hapLen) * width);
+        }
+    }
+    return cells;
+}
+
+// Plans the alignment of reads of the given lengths so that it stays within --max-cells-per-variant
+inline alignment_budget planAlignmentBudget(std::vector<size_t> const & readLengths,
+                                            haplotype_set const &       haps,
+                                            LRCOptions const &          O)
+{
+    double const budget = O.maxCellsPerVariant;
+    if (budget == 0 || alignmentCells(readLengths, haps, 1, 1, O) <= budget)
+        return {};
+
+    // fewer reads, spread evenly over the locus
+    size_t const maxStride = std::max<size_t>(readLengths.size() / BUDGET_MIN_READS, 1);
+    for (size_t stride = 2; stride <= maxStride; ++stride)
+        if (alignmentCells(readLengths, haps, stride, 1, O) <= budget)
+            return {budget_level::reads, stride, 1};
+
+    // narrower band; the number of cells shrinks roughly linearly with it
+    double const band_fac  = std::min<double>(O.bandedAlignmentPercent, 100.0) / 100.0;
+    double       bandScale = 1;
+    for (size_t attempt = 0; attempt < 8 && band_fac * bandScale >= BUDGET_MIN_BAND; ++attempt)
+    {
+        double const cells = alignmentCells(readLengths, haps, maxStride, bandScale, O);
+        if (cells <= budget)
+            return {budget_level::band, maxStride, bandScale};
+        bandScale *= 0.95 * budget / cells; // aim slightly below the budget
+    }
+
+    return {budget_level::cigar, 1, 1};
+}
+
+inline void applyBudget(haplotype_set & haps, alignment_budget const & budget)
+{
+    haps.vBand     = haps.vBand * budget.bandScale;
+    haps.bandScale = budget.bandScale;
+}
+
+// Length of a read after cropping it to the window of a variant
+template <typename mode_t>
+inline size_t croppedLength(seqan::BamAlignmentRecord const & bar, size_t const wSizeActual)
+{
+    return mode_t::cropRead ? std::min<size_t>(seqan::length(bar.seq), 4 * wSizeActual) : seqan::length(bar.seq);
+}
+
 /** Input: bamStream, a VCF entry, reference fasta and alt fasta file if required by VCF entry
     Output: variant alignment info for each read near the VCF entry
  */
-inline void LRprocessReads(seqan::VcfRecord const &                               variant,
-                           seqan::CharString const &                              chrom,
-                           seqan::FaiIndex const &                                faiI,
-                           std::vector<seqan::BamAlignmentRecord const *> const & overlappingBars,
-                           std::vector<varAlignInfo> &                            vais,
-                           size_t const                                           wSizeActual,
-                           LRCOptions const &                                     O)
+template <typename mode_t>
+inline budget_level LRprocessReads(seqan::VcfRecord const &                               variant,
+                                   seqan::CharString const &                              chrom,
+                                   seqan::FaiIndex const &                                faiI,
+                                   uint32_t const                                         idx,
+                                   std::vector<seqan::BamAlignmentRecord const *> const & overlappingBars,
+                                   std::vector<varAlignInfo> &                            vais,
+                                   size_t const                                           wSizeActual,
+                                   score_cache &                                          scoreCache,
+                                   LRCOptions const &                                     O)
 {
     if (variant.beginPos == 977572 || variant.beginPos == 977571) {
         int tmp = 0;
@@ -686,11 +913,10 @@ inline void LRprocessReads(seqan::VcfRecord const &
 
     size_t const nAlts = length(altSet);
     altSeqs.resize(nAlts);
-    if (O.verbose)
-        std::cerr << "nAlts " << nAlts << '\n';
+    LRC_DEBUG("nAlts " << nAlts);
 
     // move outside of this function
-    getLocRefAlt(variant, faiI, chrom, refSeq, altSeqs, wSizeActual, O);
+    getLocRefAlt(variant, faiI, idx, chrom, refSeq, altSeqs, wSizeActual, O);
 
     if (O.outputRefAlt)
     {
@@ -698,35 +924,34 @@ inline void LRprocessReads(seqan::VcfRecord const &
         for (size_t i = 0; i < nAlts; i++)
             std::cerr << " " << altSeqs[i];
         std::cerr << '\n';
-        return;
+        return budget_level::full;
     }
 
     if (O.mask)
         refSeq = mask(refSeq);
 
-    seqan::Score<int32_t, seqan::Simple> scoringScheme32(O.match, O.mismatch, O.gapExtend, O.gapOpen);
-    seqan::Score<int16_t, seqan::Simple> scoringScheme16(O.match, O.mismatch, O.gapExtend, O.gapOpen);
-
-    double const band_fac = std::min<double>(O.bandedAlignmentPercent, 100.0) / 100.0;
-
     // The set of alleles is the same for all alignments
-    std::vector<TSeqInfix> seqsV;
-    seqsV.resize(nAlts + 1);
-    seqsV[0] = infix(refSeq, 0, seqan::length(refSeq));
-    for (size_t j = 0; j < nAlts; ++j)
-        seqsV[j + 1] = infix(altSeqs[j], 0, seqan::length(altSeqs[j]));
+    std::vector<TSequence> haplotypes;
+    haplotypes.push_back(std::move(refSeq));
+    for (TSequence & altSeq : altSeqs)
+        haplotypes.push_back(std::move(altSeq));
 
-    int32_t const vBand = static_cast<double>(seqan::length(refSeq)) * band_fac;
+    haplotype_set haps = makeHaplotypeSet(haplotypes, wSizeActual, scoreCache, O);
 
-    // This is a set that contains the respective read at every position [needs to be same size as other set]
-    std::vector<TSeqInfix> seqsH;
-    seqsH.resize(nAlts + 1);
-    TSequence seqToAlign;
+    std::vector<size_t> readLengths;
+    if (O.maxCellsPerVariant > 0)
+        for (seqan::BamAlignmentRecord const * bar : overlappingBars)
+            readLengths.push_back(croppedLength<mode_t>(*bar, wSizeActual));
+    alignment_budget const budget = planAlignmentBudget(readLengths, haps, O);
+    applyBudget(haps, budget);
 
-    seqan::ExecutionPolicy<seqan::Serial, seqan::Vectorial> execP;
+    TSequence seqToAlign;
 
     for (size_t i = 0; i < overlappingBars.size(); ++i)
     {
+        if (!budget.aligns(i))
+            continue;
+
         seqan::BamAlignmentRecord const & b   = *overlappingBars[i];
         varAlignInfo &                    vai = vais[i];
         if (b.qName == "A00297:158:HT275DSXX:3:1570:10212:17957") {
@@ -735,51 +960,352 @@ inline void LRprocessReads(seqan::VcfRecord const &
         seqan::clear(seqToAlign);
         int tmp3 = (ssize_t)length(b.seq);
 
-        if (O.cropRead)
-            cropSeq(b, variant, wSizeActual, O, seqToAlign);
+        if constexpr (mode_t::cropRead)
+            cropSeq<mode_t>(b, variant, wSizeActual, seqToAlign);
         else
             seqToAlign = b.seq; // converts IUPAC to Dna5
-        for (auto & seqH : seqsH)
-            seqH = infix(seqToAlign, 0, seqan::length(seqToAlign));
 
-        int32_t const hBand = static_cast<double>(seqan::length(seqToAlign)) * band_fac;
+        alignRead(seqToAlign, haps, vai.alignS, scoreCache, O);
+    }
 
-        if (seqan::length(refSeq) > std::numeric_limits<int16_t>::max() &&
-            seqan::length(seqToAlign) > std::numeric_limits<int16_t>::max())
+    return budget.level;
+}
+
+// Crops the part of a read that aligns to [regionBegin, regionEnd) of the reference; this mirrors the
+// left-breakpoint case of cropSeq()
+inline void cropSeqToRegion(seqan::BamAlignmentRecord const & bar,
+                            ssize_t const                     regionBegin,
+                            ssize_t const                     regionEnd,
+                            TSequence &                       croppedSeq)
+{
+    auto &  cigarString    = bar.cigar;
+    ssize_t alignPos       = bar.beginPos;
+    ssize_t readPos        = 0;
+    ssize_t lReadPos       = 0;
+    char    cigarOperation = length(cigarString) > 0 ? cigarString[0].operation : 'M';
+
+    for (size_t cigarI = 0; alignPos < regionBegin && cigarI < length(cigarString); ++cigarI)
+    {
+        lReadPos       = readPos;
+        cigarOperation = cigarString[cigarI].operation;
+
+        switch (cigarOperation)
+        {
+            case 'D':
+                alignPos += cigarString[cigarI].count;
+                break;
+            case '=':
+            case 'X':
+            case 'M':
+                alignPos += cigarString[cigarI].count;
+                [[fallthrough]];
+            case 'S':
+            case 'I':
+                readPos += cigarString[cigarI].count;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (cigarOperation == 'S' || cigarOperation == 'H')
+        readPos = lReadPos;
+
+    ssize_t const regionLength = regionEnd - regionBegin;
+    ssize_t const rShift       = alignPos - regionBegin;
+    ssize_t       rBeg         = std::max<ssize_t>(readPos - rShift, 0);
+    ssize_t       rEnd         = std::max<ssize_t>(readPos + regionLength - rShift, regionLength);
+    rEnd                       = std::min<ssize_t>(rEnd, length(bar.seq));
+    if (rBeg >= rEnd)
+        rBeg = std::max<ssize_t>(rEnd - 1, 0);
+
+    croppedSeq = infixWithLength(bar.seq, rBeg, rEnd - rBeg);
+}
+
+// Co-located records share their reference haplotype and read windows
+inline bool isColocated(seqan::VcfRecord const & lhs, seqan::VcfRecord const & rhs, LRCOptions const & O)
+{
+    return lhs.rID == rhs.rID && lhs.beginPos == rhs.beginPos &&
+           (!O.genotypeRightBreakpoint || length(lhs.ref) == length(rhs.ref));
+}
+
+/* Number of variants at the beginning of vcfRecords that are aligned jointly (always at least one).
+ * Co-located records are always merged; nearby variants also form a cluster if --cluster-alignment is given.
+ * Variants with alleles longer than the window are not clustered.
+ */
+inline size_t getClusterSize(std::span<seqan::VcfRecord const> vcfRecords,
+                             size_t const                      wSizeActual,
+                             LRCOptions const &                O)
+{
+    if (O.outputRefAlt)
+        return 1;
+
+    size_t nColocated = 1;
+    while (nColocated < vcfRecords.size() && isColocated(vcfRecords.front(), vcfRecords[nColocated], O))
+        ++nColocated;
+
+    if (!O.clusterAlignment || O.genotypeRightBreakpoint)
+        return nColocated;
+
+    size_t n = 0;
+    for (; n < vcfRecords.size(); ++n)
+    {
+        seqan::VcfRecord const & var = vcfRecords[n];
+
+        if (var.beginPos - vcfRecords.front().beginPos > (ssize_t)O.clusterSpan)
+            break;
+
+        size_t maxAlleleLength = seqan::length(var.ref);
+        for (size_t i = 0, len = 1; i <= seqan::length(var.alt); ++i, ++len)
+        {
+            if (i == seqan::length(var.alt) || var.alt[i] == ',')
+            {
+                maxAlleleLength = std::max(maxAlleleLength, len - 1);
+                len             = 0;
+            }
+        }
+        if (maxAlleleLength > wSizeActual)
+            break;
+    }
+
+    return std::max(n, nColocated);
+}
+
+// Adds a haplotype unless an identical one is already part of the set; returns its index
+inline size_t addHaplotype(std::vector<TSequence> & haplotypes, TSequence && hap)
+{
+    for (size_t h = 0; h < haplotypes.size(); ++h)
+        if (haplotypes[h] == hap)
+            return h;
+
+    haplotypes.push_back(std::move(hap));
+    return haplotypes.size() - 1;
+}
+
+// Scores of the distinct reads of several records against all haplotypes (see alignDistinctReads())
+struct read_scores
+{
+    std::unordered_map<seqan::BamAlignmentRecord const *, size_t> index;  // of every read in scores
+    std::vector<std::vector<double>>                              scores; // per read and haplotype
+    budget_level                                                  level = budget_level::full;
+
+    std::vector<double> const & of(seqan::BamAlignmentRecord const * bar) const { return scores[index.at(bar)]; }
+};
+
+/* Aligns every read once against all haplotypes, even if it overlaps several records, and within the budget.
+ * windowLength(bar) returns the length of the part of a read that is aligned, cropWindow(bar, seq) extracts it.
+ */
+template <typename window_length_t, typename crop_window_t>
+inline read_scores
+alignDistinctReads(std::vector<std::vector<seqan::BamAlignmentRecord const *>> const & overlappingBars,
+                   haplotype_set &                                                     haps,
+                   window_length_t &&                                                  windowLength,
+                   crop_window_t &&                                                    cropWindow,
+                   score_cache &                                                       scoreCache,
+                   LRCOptions const &                                                  O)
+{
+    read_scores                                    ret;
+    std::vector<seqan::BamAlignmentRecord const *> reads;
+    for (std::vector<seqan::BamAlignmentRecord const *> const & bars : overlappingBars)
+        for (seqan::BamAlignmentRecord const * bar : bars)
+            if (ret.index.emplace(bar, reads.size()).second)
+                reads.push_back(bar);
+
+    std::vector<size_t> readLengths;
+    if (O.maxCellsPerVariant > 0)
+        for (seqan::BamAlignmentRecord const * bar : reads)
+            readLengths.push_back(windowLength(*bar));
+    alignment_budget const budget = planAlignmentBudget(readLengths, haps, O);
+    applyBudget(haps, budget);
+    ret.level = budget.level;
+
+    ret.scores.assign(reads.size(), std::vector<double>(haps.seqs.size(), NO_ALIGNMENT));
+    TSequence seqToAlign;
+    for (size_t r = 0; r < reads.size(); ++r)
+    {
+        if (!budget.aligns(r))
+            continue;
+
+        cropWindow(*reads[r], seqToAlign);
+        alignRead(seqToAlign, haps, ret.scores[r], scoreCache, O);
+    }
+
+    return ret;
+}
+
+/* Co-located records (e.g. from callsets merged from several callers) are treated as a single multi-allelic locus:
+ * every read is aligned once against the union of their distinct haplotypes, and the scores are then split back
+ * into the records. The windows are the same as for separate processing, so are the results.
+ */
+template <typename mode_t>
+inline budget_level
+LRprocessColocated(std::span<seqan::VcfRecord const>                                   records,
+                   seqan::CharString const &                                           chrom,
+                   seqan::FaiIndex const &                                             faiI,
+                   uint32_t const                                                      idx,
+                   std::vector<std::vector<seqan::BamAlignmentRecord const *>> const & overlappingBars,
+                   std::vector<std::vector<varAlignInfo>> &                            vais,
+                   size_t const                                                        wSizeActual,
+                   score_cache &                                                       scoreCache,
+                   LRCOptions const &                                                  O)
+{
+    std::vector<TSequence>           haplotypes;
+    std::vector<std::vector<size_t>> hapOfAllele(records.size()); // allele 0 is the reference
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        seqan::StringSet<seqan::CharString> altSet;
+        strSplit(altSet, records[i].alt, seqan::EqualsChar<','>());
+
+        TSequence              refSeq;
+        std::vector<TSequence> altSeqs(length(altSet));
+        getLocRefAlt(records[i], faiI, idx, chrom, refSeq, altSeqs, wSizeActual, O);
+
+        if (O.mask)
+            refSeq = mask(refSeq);
+
+        // the first reference haplotype becomes haplotype 0, all others are identical to it
+        hapOfAllele[i].push_back(addHaplotype(haplotypes, std::move(refSeq)));
+        for (TSequence & altSeq : altSeqs)
+            hapOfAllele[i].push_back(addHaplotype(haplotypes, std::move(altSeq)));
+    }
+
+    haplotype_set haps = makeHaplotypeSet(haplotypes, wSizeActual, scoreCache, O);
+
+    // the read window only depends on the position (and REF length, which is the same)
+    read_scores const readScores = alignDistinctReads(
+      overlappingBars,
+      haps,
+      [&](seqan::BamAlignmentRecord const & bar) { return croppedLength<mode_t>(bar, wSizeActual); },
+      [&](seqan::BamAlignmentRecord const & bar, TSequence & seqToAlign)
+      {
+          if constexpr (mode_t::cropRead)
+              cropSeq<mode_t>(bar, records.front(), wSizeActual, seqToAlign);
+          else
+              seqToAlign = bar.seq; // converts IUPAC to Dna5
+      },
+      scoreCache,
+      O);
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        for (size_t k = 0; k < overlappingBars[i].size(); ++k)
         {
-            auto scores = seqan::localAlignmentScore(execP, seqsH, seqsV, scoringScheme32, -vBand, +hBand);
+            std::vector<double> const & scores = readScores.of(overlappingBars[i][k]);
+            varAlignInfo &              vai    = vais[i][k];
 
-            for (size_t j = 0; j < seqan::length(vai.alignS); ++j)
-                vai.alignS[j] = scores[j];
+            for (size_t a = 0; a < hapOfAllele[i].size(); ++a)
+                vai.alignS[a] = scores[hapOfAllele[i][a]];
         }
-        else // this allows better vectorisation
+    }
+
+    return readScores.level;
+}
+
+/* Aligns every read of a cluster of nearby variants once against haplotypes that span the whole cluster: the
+ * reference, and for every variant each of its alternative alleles on an otherwise reference background.
+ * Per variant, an alternative allele gets the score of its haplotype, and the reference allele the best score of
+ * all haplotypes that do not carry an alternative allele of that variant.
+ */
+template <typename mode_t>
+inline budget_level
+LRprocessCluster(std::span<seqan::VcfRecord const>                                   cluster,
+                 seqan::CharString const &                                           chrom,
+                 seqan::FaiIndex const &                                             faiI,
+                 uint32_t const                                                      idx,
+                 std::vector<std::vector<seqan::BamAlignmentRecord const *>> const & overlappingBars,
+                 std::vector<std::vector<varAlignInfo>> &                            vais,
+                 size_t const                                                        wSizeActual,
+                 score_cache &                                                       scoreCache,
+                 LRCOptions const &                                                  O)
+{
+    ssize_t const clusterBegin = std::max<ssize_t>(cluster.front().beginPos - (ssize_t)wSizeActual, 0);
+    ssize_t       clusterEnd   = 0;
+    for (seqan::VcfRecord const & var : cluster)
+        clusterEnd = std::max<ssize_t>(clusterEnd, var.beginPos + length(var.ref) + wSizeActual);
+
+    TSequence refSeq;
+    readRegion(refSeq, faiI, idx, clusterBegin, clusterEnd);
+
+    std::vector<TSequence>           haplotypes{refSeq};
+    std::vector<std::vector<size_t>> hapOfAllele(cluster.size()); // haplotype carrying the respective alt allele
+
+    for (size_t i = 0; i < cluster.size(); ++i)
+    {
+        seqan::StringSet<seqan::CharString> altSet;
+        strSplit(altSet, cluster[i].alt, seqan::EqualsChar<','>());
+
+        size_t const off    = std::min<size_t>(cluster[i].beginPos - clusterBegin, length(refSeq));
+        size_t const offEnd = std::min<size_t>(off + length(cluster[i].ref), length(refSeq));
+
+        for (size_t a = 0; a < length(altSet); ++a)
         {
-            auto scores = seqan::localAlignmentScore(execP, seqsH, seqsV, scoringScheme16, -vBand, +hBand);
+            TSequence hap = prefix(refSeq, off);
+            TSequence alt = altSet[a];
+            append(hap, alt);
+            append(hap, suffix(refSeq, offEnd));
 
-            for (size_t j = 0; j < seqan::length(vai.alignS); ++j)
-                vai.alignS[j] = scores[j];
+            // co-located records may share alt alleles; identical haplotypes are only aligned once
+            hapOfAllele[i].push_back(addHaplotype(haplotypes, std::move(hap)));
         }
     }
+
+    if (O.mask)
+        haplotypes[0] = mask(haplotypes[0]);
+
+    haplotype_set haps = makeHaplotypeSet(haplotypes, wSizeActual, scoreCache, O);
+
+    // reads are cropped to the whole cluster
+    read_scores const readScores = alignDistinctReads(
+      overlappingBars,
+      haps,
+      [&](seqan::BamAlignmentRecord const & bar)
+      { return mode_t::cropRead ? std::min<size_t>(length(bar.seq), length(refSeq)) : length(bar.seq); },
+      [&](seqan::BamAlignmentRecord const & bar, TSequence & seqToAlign)
+      {
+          if constexpr (mode_t::cropRead)
+              cropSeqToRegion(bar, clusterBegin, clusterBegin + length(refSeq), seqToAlign);
+          else
+              seqToAlign = bar.seq; // converts IUPAC to Dna5
+      },
+      scoreCache,
+      O);
+
+    for (size_t i = 0; i < cluster.size(); ++i)
+    {
+        std::vector<bool> carriesAlt(haplotypes.size(), false);
+        for (size_t h : hapOfAllele[i])
+            carriesAlt[h] = true;
+
+        for (size_t k = 0; k < overlappingBars[i].size(); ++k)
+        {
+            std::vector<double> const & scores = readScores.of(overlappingBars[i][k]);
+            varAlignInfo &              vai    = vais[i][k];
+
+            vai.alignS[0] = NO_ALIGNMENT;
+            for (size_t h = 0; h < haplotypes.size(); ++h)
+                if (!carriesAlt[h])
+                    vai.alignS[0] = std::max(vai.alignS[0], scores[h]);
+
+            for (size_t a = 0; a < hapOfAllele[i].size(); ++a)
+                vai.alignS[a + 1] = scores[hapOfAllele[i][a]];
+        }
+    }
+
+    return readScores.level;
 }
 
-inline void initializeBam(std::string fileName, seqan::BamIndex<seqan::Bai> & bamIndex, seqan::BamFileIn & bamStream)
+inline void initializeBam(std::filesystem::path const & fileName, seqan::BamFileIn & bamStream)
 {
-    if (!seqan::open(bamStream, fileName.data()))
+    if (!seqan::open(bamStream, fileName.c_str()))
         throw error{"Could not open ", fileName, " for reading."};
 
-    fileName += ".bai";
-    if (!seqan::open(bamIndex, fileName.data()))
-        throw error{"Could not read BAI index file ", fileName};
-
     seqan::BamHeader header;
     readHeader(header, bamStream);
 }
 
-// Open a bam file or a set of bam files if the filename does not end with .bam
-inline void parseBamFileName(std::filesystem::path const &              bfN,
-                             std::vector<seqan::BamFileIn> &            bamStreamV,
-                             std::vector<seqan::BamIndex<seqan::Bai>> & bamIndexV,
-                             LRCOptions const &                         O)
+// The paths of a bam file or of a set of bam files if the filename does not end with .bam
+inline std::vector<std::filesystem::path> parseBamFileName(std::filesystem::path const & bfN, LRCOptions const & O)
 {
     std::vector<std::filesystem::path> paths;
 
@@ -822,6 +1348,9 @@ inline void parseBamFileName(std::filesystem::path const &              bfN,
 
             std::filesystem::copy(p, new_p);
             std::filesystem::copy(p_bai, new_p_bai);
+            // keep the timestamps, so that the copies still match the index cache
+            std::filesystem::last_write_time(new_p, std::filesystem::last_write_time(p));
+            std::filesystem::last_write_time(new_p_bai, std::filesystem::last_write_time(p_bai));
 
             p = new_p; // update path in-place
         }
@@ -830,15 +1359,12 @@ inline void parseBamFileName(std::filesystem::path const &              bfN,
     if (O.verbose)
         std::cerr << " done.";
 
-    bamIndexV.resize(paths.size());
-    bamStreamV.resize(paths.size());
-
-    for (size_t i = 0; i < paths.size(); ++i)
-        initializeBam(paths[i], bamIndexV[i], bamStreamV[i]);
+    return paths;
 }
 
 // Examines a seqan::BamAlignmentRecord for evidence of supporting a variant and writes evidence into varAlignInfo
 // record
+template <typename mode_t>
 inline void examineBamAlignment(seqan::BamAlignmentRecord const & bar,
                                 seqan::VcfRecord const &          var,
                                 varAlignInfo &                    vai,
@@ -904,8 +1430,7 @@ inline void examineBamAlignment(seqan::BamAlignmentRecord const & bar,
       regionEnd = std::atoi( var.infos["TRREND"] ) + O.varWindow;
       if( O.verbose ) std::cerr << "Found TRR " << regionBeg << " " << regionEnd << '\n';
   }else{*/
-    if (O.verbose)
-        std::cerr << "TRR " << regionBeg << " " << regionEnd << '\n';
+    LRC_DEBUG("TRR " << regionBeg << " " << regionEnd);
     //  }
 
     if (alignPos  < regionBeg)
@@ -949,7 +1474,7 @@ inline void examineBamAlignment(seqan::BamAlignmentRecord const & bar,
             case 'S':
                 if (cigarString[cigarI].count > O.maxSoftClipped)
                 {
-                    if (!O.genotypeRightBreakpoint)
+                    if constexpr (!mode_t::rightBreakpoint)
                     {
                         if (cigarI == length(cigarString) - 1)
                             vai.softClipped = true;
@@ -967,19 +1492,18 @@ inline void examineBamAlignment(seqan::BamAlignmentRecord const & bar,
                 std::cerr << "WARNING: cigar string case not accounted for \n";
         }
 
-        if (O.verbose)
-            std::cerr << bar.qName << " " << cigarOperation << " " << cigarString[cigarI].count << " " << alignPos
-                      << " " << cigarI << " " << vai.nD << " " << vai.nI << '\n';
+        LRC_TRACE(bar.qName << " " << cigarOperation << " " << cigarString[cigarI].count << " " << alignPos << " "
+                            << cigarI << " " << vai.nD << " " << vai.nI);
         cigarI++;
     }
     if (alignPos > regionEnd)
         vai.alignsRight = true;
 
-    if (O.verbose)
-        std::cerr << "examinSeq " << bar.qName << " " << vai.nD << " " << vai.nI << " " << vai.softClipped << '\n';
+    LRC_DEBUG("examinSeq " << bar.qName << " " << vai.nD << " " << vai.nI << " " << vai.softClipped);
 }
 
 // Gets reads in the region overlapping the variant
+template <typename mode_t>
 inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
                        seqan::VcfRecord const &                         var,
                        std::vector<seqan::BamAlignmentRecord const *> & overlappingBars,
@@ -993,7 +1517,7 @@ inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
         int tmp = 0;
     }
 
-    if (O.genotypeRightBreakpoint)
+    if constexpr (mode_t::rightBreakpoint)
     {
         beg = beg + length(var.ref);
         end = end + length(var.ref);
@@ -1006,7 +1530,7 @@ inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
     varAlignInfo vai(nAlts + 1);
 
     int32_t stopReading = beg;
-    if (O.genotypeRightBreakpoint)
+    if constexpr (mode_t::rightBreakpoint)
         stopReading = end;
 
     // TODO evaluate unordered_map here
@@ -1025,10 +1549,9 @@ inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
             (record.beginPos + (int32_t)getAlignmentLengthInRef(record) < beg) || record.mapQ < O.minMapQ)
             continue;
 
-        examineBamAlignment(record, var, vai, O);
+        examineBamAlignment<mode_t>(record, var, vai, O);
 
-        if (O.verbose)
-            std::cerr << "Read record " << record.qName << '\n';
+        LRC_DEBUG("Read record " << record.qName);
 
         // If we are on the next reference or at the end already then we stop.
         if (/*record.rID == -1 || record.rID > rID || */ record.beginPos >= end)
@@ -1036,26 +1559,25 @@ inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
 
         // If we are left of the selected position then we skip this record.
         bool softClipRemove = false;
-        if (not O.genotypeRightBreakpoint)
+        if constexpr (!mode_t::rightBreakpoint)
         {
             char cigarOperation = record.cigar[0].operation;
             if (cigarOperation == 'S' && (record.cigar[0].count > O.maxSoftClipped))
             {
                 softClipRemove = true;
-                if (O.verbose)
-                    std::cerr << "SoftClip removed LeftBreakpoint " << record.qName << " " << O.genotypeRightBreakpoint
-                              << " " << record.cigar[0].count << " " << O.maxSoftClipped << '\n';
+                LRC_DEBUG("SoftClip removed LeftBreakpoint " << record.qName << " " << mode_t::rightBreakpoint << " "
+                                                             << record.cigar[0].count << " " << O.maxSoftClipped);
             }
         }
-        else if (O.genotypeRightBreakpoint)
+        else
         {
             char cigarOperation = record.cigar[length(record.cigar) - 1].operation;
             if (cigarOperation == 'S' && (record.cigar[length(record.cigar) - 1].count > O.maxSoftClipped))
             {
                 softClipRemove = true;
-                if (O.verbose)
-                    std::cerr << "SoftClip removed RightBreakpoint " << record.qName << " " << O.genotypeRightBreakpoint
-                              << " " << record.cigar[length(record.cigar) - 1].count << " " << O.maxSoftClipped << '\n';
+                LRC_DEBUG("SoftClip removed RightBreakpoint "
+                          << record.qName << " " << mode_t::rightBreakpoint << " "
+                          << record.cigar[length(record.cigar) - 1].count << " " << O.maxSoftClipped);
             }
         }
 
@@ -1066,8 +1588,7 @@ inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
         if ((cigarOperationL == 'H') || (cigarOperationR == 'H'))
         {
             hardClipped = true;
-            if (O.verbose)
-                std::cerr << "Read " << record.qName << " is hardclipped at " << record.beginPos << '\n';
+            LRC_DEBUG("Read " << record.qName << " is hardclipped at " << record.beginPos);
         }
 
         if ((!softClipRemove) && (!hasFlagDuplicate(record)) && (!hasFlagQCNoPass(record)) && (!hardClipped))
@@ -1089,12 +1610,10 @@ inline void parseReads(std::vector<seqan::BamAlignmentRecord> const &   bars,
             }
         }
 
-        if (O.verbose)
-            std::cerr << "Finished soft clipping " << '\n';
+        LRC_DEBUG("Finished soft clipping ");
     }
 
-    if (O.verbose)
-        std::cerr << "Exiting readBamRegion " << '\n';
+    LRC_DEBUG("Exiting readBamRegion ");
 }
 
 std::vector<std::string> split (std::string s, std::string delimiter) {
@@ -1149,17 +1668,38 @@ inline size_t getWSizeActual(std::span<seqan::VcfRecord> vcfRecords, LRCOptions
     }
 }
 
-inline void                         processChunk(std::vector<seqan::BamFileIn> &            bamFiles,
-                         std::vector<seqan::BamIndex<seqan::Bai>> & bamIndexes,
-                         seqan::FaiIndex &                          faIndex,
-                         seqan::CharString const &                  chrom,
-                         std::vector<seqan::BamAlignmentRecord> &   bars,
-                         std::span<seqan::VcfRecord>                vcfRecords,
-                         LRCOptions const &                         O)
+// Whether var is too far from the previous record to share its chunk (reads are fetched once per chunk)
+inline bool startsNewChunk(seqan::VcfRecord const & lastVar, seqan::VcfRecord const & var, LRCOptions const & O)
+{
+    return (var.rID != lastVar.rID) || (var.beginPos > lastVar.beginPos + (ssize_t)O.wSize);
+}
+
+// Splits records into chunks of adjacent variants
+inline std::vector<std::span<seqan::VcfRecord>> splitIntoChunks(std::span<seqan::VcfRecord> records,
+                                                                 LRCOptions const &          O)
 {
-    size_t const wSizeActual = getWSizeActual(vcfRecords, O);
+    std::vector<std::span<seqan::VcfRecord>> chunks;
+    size_t                                   chunk_first = 0;
+    for (size_t i = 1; i < records.size(); ++i)
+    {
+        if (startsNewChunk(records[i - 1], records[i], O))
+        {
+            chunks.push_back(records.subspan(chunk_first, i - chunk_first));
+            chunk_first = i;
+        }
+    }
+
+    if (chunk_first < records.size()) // last chunk
+        chunks.push_back(records.subspan(chunk_first));
 
-    /* Determine chromosome interval to fetch records for */
+    return chunks;
+}
+
+// Chromosome interval to fetch the reads of a chunk for
+inline std::pair<size_t, size_t> chunkInterval(std::span<seqan::VcfRecord const> vcfRecords,
+                                               size_t const                       wSizeActual,
+                                               LRCOptions const &                 O)
+{
     size_t genome_begin = vcfRecords.front().beginPos;
     size_t genome_end   = vcfRecords.back().beginPos + 1;
 
@@ -1168,7 +1708,7 @@ inline void                         processChunk(std::vector<seqan::BamFileIn> &
         size_t minVarRef = std::numeric_limits<size_t>::max();
         size_t maxVarRef = std::numeric_limits<size_t>::min();
 
-        for (seqan::VcfRecord & var : vcfRecords)
+        for (seqan::VcfRecord const & var : vcfRecords)
         {
             minVarRef = std::min<size_t>(minVarRef, seqan::length(var.ref));
             maxVarRef = std::max<size_t>(maxVarRef, seqan::length(var.ref));
@@ -1181,16 +1721,157 @@ inline void                         processChunk(std::vector<seqan::BamFileIn> &
     genome_begin = wSizeActual >= genome_begin ? 1 : genome_begin - wSizeActual;
     genome_end += wSizeActual;
 
+    return {genome_begin, genome_end};
+}
+
+// Values for the first sample of a variant without usable reads (as returned by genotypeVariant())
+inline constexpr std::string_view NO_READS_SAMPLE_VALUES = ":.:.";
+
+// Values for the first sample from the accumulated evidence of a variant
+inline std::string evidenceSampleValues(variant_evidence const & evidence)
+{
+    std::string gtString;
+    for (size_t mI = 0; mI < evidence.vC.size(); mI++)
+    {
+        std::vector<double> lls = evidence.vC[mI]; // getGtString() negates them
+        getGtString(lls, evidence.AD[mI], evidence.VA[mI], evidence.qnames, gtString);
+//            appendValue(var.genotypeInfos, gtString);
+//            var.genotypeInfos[0] += gtString;
+    }
+    return gtString;
+}
+
+// Genotypes a variant from the alignment information of its reads; returns the values for the first sample
+// If evidence is given, the reads are added to it (skipping those it already counted) and it is genotyped as a whole
+inline std::string genotypeVariant(seqan::VcfRecord const &          var,
+                                   std::vector<varAlignInfo> const & alignInfos,
+                                   size_t const                      wSizeActual,
+                                   LRCOptions const &                O,
+                                   variant_evidence *                evidence = nullptr)
+{
+    size_t nAlleles = 2;
+    for (char c : var.alt)
+        if (c == ',')
+            ++nAlleles;
+
+    // Implemented as a std::vector as we may have more than one output per marker
+    variant_evidence   local;
+    variant_evidence & ev = evidence != nullptr ? *evidence : local;
+    if (ev.empty())
+    {
+        size_t const nModels = genotypingModelCount(O.gtModel);
+        ev.vC.resize(nModels); // variant calls
+        ev.AD.resize(nModels); // Allele depth counts
+        ev.VA.resize(nModels); // Variant seqan::Alignment counts
+        for (size_t mI = 0; mI < nModels; mI++)
+        {
+            ev.vC[mI].resize(nAlleles * (nAlleles + 1) / 2);
+            ev.AD[mI].resize(nAlleles + 1);
+            ev.VA[mI].resize(nAlleles + 1);
+        }
+        ev.qnames.resize(nAlleles + 1);
+    }
+
+    // reads that were counted before (e.g. because they are in the old and the new BAM files) are not counted again
+    std::vector<varAlignInfo>         newReads;
+    std::vector<varAlignInfo> const * reads = &alignInfos;
+    if (evidence != nullptr)
+    {
+        if (!ev.readHashes.empty())
+        {
+            std::ranges::copy_if(alignInfos,
+                                 std::back_inserter(newReads),
+                                 [&](varAlignInfo const & vai)
+                                 { return !std::ranges::binary_search(ev.readHashes, readNameHash(vai.qname)); });
+            reads = &newReads;
+        }
+        for (varAlignInfo const & vai : *reads)
+            ev.readHashes.push_back(readNameHash(vai.qname));
+        std::ranges::sort(ev.readHashes);
+        ev.readHashes.erase(std::ranges::unique(ev.readHashes).begin(), ev.readHashes.end());
+    }
+
+    auto const update = [&](auto const gtm, size_t const mI)
+    { multiUpdateVC<gtm>(var, *reads, ev.vC[mI], ev.AD[mI], ev.VA[mI], ev.qnames, wSizeActual, O); };
+
+    switch (O.gtModel)
+    {
+        case genotyping_model::multi:
+            update(gt_model<genotyping_model::ad>, 0);
+            update(gt_model<genotyping_model::va>, 1);
+            update(gt_model<genotyping_model::joint>, 2);
+            update(gt_model<genotyping_model::presence>, 3);
+            update(gt_model<genotyping_model::va_old>, 4);
+            break;
+        case genotyping_model::ad:
+            update(gt_model<genotyping_model::ad>, 0);
+            break;
+        case genotyping_model::va:
+            update(gt_model<genotyping_model::va>, 0);
+            break;
+        case genotyping_model::presence:
+            update(gt_model<genotyping_model::presence>, 0);
+            break;
+        case genotyping_model::va_old:
+            update(gt_model<genotyping_model::va_old>, 0);
+            break;
+        case genotyping_model::joint:
+            update(gt_model<genotyping_model::joint>, 0);
+            break;
+    }
+
+    return evidenceSampleValues(ev);
+}
+
+template <typename mode_t>
+inline void processChunk(std::vector<seqan::BamFileIn> &          bamFiles,
+                         std::vector<bai_index> const &           bamIndexes,
+                         bam_prefetcher const &                   prefetcher,
+                         seqan::FaiIndex &                        faIndex,
+                         seqan::CharString const &                chrom,
+                         contig_table const &                     contigs,
+                         std::vector<seqan::BamAlignmentRecord> & bars,
+                         std::span<seqan::VcfRecord>              vcfRecords,
+                         std::span<std::string>                   sampleValues,
+                         std::span<budget_level>                  budgetLevels,
+                         std::span<variant_evidence>              evidence,
+                         score_cache &                            scoreCache,
+                         LRCOptions const &                       O)
+{
+    size_t const   wSizeActual = getWSizeActual(vcfRecords, O);
+    int32_t const  rID         = vcfRecords.front().rID;
+    uint32_t const faiId       = contigs.faiId(rID);
+
+    auto const [genome_begin, genome_end] = chunkInterval(vcfRecords, wSizeActual, O);
+
+    // let the kernel read ahead in all BAM files at once (no-op without --prefetch)
+    prefetcher.prefetchRegion(bamIndexes, contigs, rID, genome_begin, genome_end);
+
     /* read BAM files for this chunk */
     for (size_t i = 0; i < bamFiles.size(); ++i)
     {
-        size_t bamRID = 0;
-        if (seqan::getIdByName(bamRID, seqan::contigNamesCache(seqan::context(bamFiles[i])), chrom))
-            viewRecords(bars, bamFiles[i], bamIndexes[i], bamRID, genome_begin, genome_end);
+        alloc_stage_scope stage{alloc_stage::fetch};
+        if (uint32_t const bamRID = contigs.bamId(rID, i); bamRID != NO_CONTIG)
+            fetchRecords(bars, bamFiles[i], bamIndexes[i], bamRID, genome_begin, genome_end);
 
         // else: BAM files that have no reads spanning the desired chromosome are quietly ignored
     }
 
+    // without new reads, records keep the values of their stored evidence (if any; see evidence.hpp)
+    auto noReadsValues = [&](size_t const i)
+    {
+        return evidence.empty() || evidence[i].empty() ? std::string{NO_READS_SAMPLE_VALUES}
+                                                       : evidenceSampleValues(evidence[i]);
+    };
+
+    // nothing to extract or align in gaps, on unplaced contigs or without coverage
+    if (bars.empty() && !O.outputRefAlt)
+    {
+        for (size_t i = 0; i < vcfRecords.size(); ++i)
+            sampleValues[i] = noReadsValues(i);
+        return;
+    }
+
     if (bamFiles.size() > 1)
     {
         std::ranges::sort(bars,
@@ -1198,71 +1879,95 @@ inline void                         processChunk(std::vector<seqan::BamFileIn> &
                           { return lhs.beginPos < rhs.beginPos; });
     }
 
-    /* process variants */
-    for (seqan::VcfRecord & var : vcfRecords)
+    /* process variants; co-located variants (and nearby ones with --cluster-alignment) are aligned together */
+    for (size_t first = 0; first < vcfRecords.size();)
     {
-        size_t nAlleles = 2;
-        for (char c : var.alt)
-            if (c == ',')
-                ++nAlleles;
-
-        // Implemented as a std::vector as we may have more than one output per marker
-        std::vector<std::vector<double>> vC; // variant calls
-        std::vector<std::vector<size_t>> AD; // Allele depth counts
-        std::vector<std::vector<size_t>> VA; // Variant seqan::Alignment counts
-        std::vector<std::string> VA_QNAMES;
-
-        if (O.gtModel == genotyping_model::multi)
-        {
-            vC.resize(5);
-            AD.resize(5);
-            VA.resize(5);
-        }
-        else
-        {
-            vC.resize(1);
-            AD.resize(1);
-            VA.resize(1);
-        }
+        size_t const                clusterSize = getClusterSize(vcfRecords.subspan(first), wSizeActual, O);
+        std::span<seqan::VcfRecord> cluster     = vcfRecords.subspan(first, clusterSize);
 
-        for (size_t mI = 0; mI < vC.size(); mI++)
-        {
-            vC[mI].resize(nAlleles * (nAlleles + 1) / 2);
-            AD[mI].resize(nAlleles + 1);
-            VA[mI].resize(nAlleles + 1);
-        }
-        VA_QNAMES.resize(nAlleles + 1);
-
-        std::vector<seqan::BamAlignmentRecord const *> overlappingBars;
-        std::vector<varAlignInfo>                      alignInfos;
+        std::vector<std::vector<seqan::BamAlignmentRecord const *>> overlappingBars(clusterSize);
+        std::vector<std::vector<varAlignInfo>>                      alignInfos(clusterSize);
         try{
-            parseReads(bars, var, overlappingBars, alignInfos, wSizeActual, O);
-            LRprocessReads(var, chrom, faIndex, overlappingBars, alignInfos, wSizeActual, O);
+            bool anyReads = false;
+            for (size_t i = 0; i < clusterSize; ++i)
+            {
+                alloc_stage_scope stage{alloc_stage::parse};
+                parseReads<mode_t>(bars, cluster[i], overlappingBars[i], alignInfos[i], wSizeActual, O);
+                anyReads |= !overlappingBars[i].empty();
+            }
+
+            // without usable reads, no reference sequence needs to be extracted
+            if (!anyReads && !O.outputRefAlt)
+            {
+                for (size_t i = 0; i < clusterSize; ++i)
+                    sampleValues[first + i] = noReadsValues(first + i);
+                first += clusterSize;
+                continue;
+            }
+
+            // without reference sequence (reported by contig_table), reads are counted but not aligned
+            if (faiId != NO_CONTIG)
+            {
+                alloc_stage_scope stage{alloc_stage::align};
+                budget_level      level;
+                if (clusterSize == 1)
+                    level = LRprocessReads<mode_t>(cluster[0],
+                                                   chrom,
+                                                   faIndex,
+                                                   faiId,
+                                                   overlappingBars[0],
+                                                   alignInfos[0],
+                                                   wSizeActual,
+                                                   scoreCache,
+                                                   O);
+                else if (isColocated(cluster.front(), cluster.back(), O))
+                    level = LRprocessColocated<mode_t>(cluster,
+                                                       chrom,
+                                                       faIndex,
+                                                       faiId,
+                                                       overlappingBars,
+                                                       alignInfos,
+                                                       wSizeActual,
+                                                       scoreCache,
+                                                       O);
+                else
+                    level = LRprocessCluster<mode_t>(cluster,
+                                                     chrom,
+                                                     faIndex,
+                                                     faiId,
+                                                     overlappingBars,
+                                                     alignInfos,
+                                                     wSizeActual,
+                                                     scoreCache,
+                                                     O);
+
+                std::ranges::fill(budgetLevels.subspan(first, clusterSize), level);
+            }
         } catch (std::exception	e) {
-            std::cout<<"execption"<<var.beginPos<<std::endl;
+            std::cerr<<"execption"<<cluster.front().beginPos<<std::endl;
         }
 
-        if (O.gtModel == genotyping_model::multi)
-        {
-            multiUpdateVC(var, alignInfos, vC[0], AD[0], VA[0],VA_QNAMES, wSizeActual, O, genotyping_model::ad);
-            multiUpdateVC(var, alignInfos, vC[1], AD[1], VA[1],VA_QNAMES, wSizeActual, O, genotyping_model::va);
-            multiUpdateVC(var, alignInfos, vC[2], AD[2], VA[2],VA_QNAMES, wSizeActual, O, genotyping_model::joint);
-            multiUpdateVC(var, alignInfos, vC[3], AD[3], VA[3],VA_QNAMES, wSizeActual, O, genotyping_model::presence);
-            multiUpdateVC(var, alignInfos, vC[4], AD[4], VA[4],VA_QNAMES, wSizeActual, O, genotyping_model::va_old);
-        }
-        else
+        for (size_t i = 0; i < clusterSize; ++i)
         {
-            multiUpdateVC(var, alignInfos, vC[0], AD[0], VA[0],VA_QNAMES, wSizeActual, O, O.gtModel);
+            alloc_stage_scope stage{alloc_stage::genotype};
+            sampleValues[first + i] = genotypeVariant(cluster[i],
+                                                      alignInfos[i],
+                                                      wSizeActual,
+                                                      O,
+                                                      evidence.empty() ? nullptr : &evidence[first + i]);
         }
 
-        std::string gtString;
-        for (size_t mI = 0; mI < vC.size(); mI++)
-        {
-            getGtString(vC[mI], AD[mI], VA[mI],VA_QNAMES, gtString);
-//            appendValue(var.genotypeInfos, gtString);
-//            var.genotypeInfos[0] += gtString;
-        }
-        var.genotypeInfos[0] += gtString;
-        var.format += ":REFREADS:ALTREADS";
+        first += clusterSize;
     }
 }
+
+using process_chunk_t = decltype(processChunk<chunk_mode<false, false>>);
+
+// The instance of processChunk() for the options of a run
+inline process_chunk_t * chunkProcessor(LRCOptions const & O)
+{
+    if (O.genotypeRightBreakpoint)
+        return O.cropRead ? &processChunk<chunk_mode<true, true>> : &processChunk<chunk_mode<true, false>>;
+    else
+        return O.cropRead ? &processChunk<chunk_mode<false, true>> : &processChunk<chunk_mode<false, false>>;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+/* Intra-sequence alignment kernel
+ *
+ * SeqAn's vectorised localAlignmentScore() puts different sequence pairs into the lanes of a SIMD register. LRcaller
+ * only ever has (number of alleles) pairs per read, so for few but very long pairs most lanes stay empty. The kernel
+ * below instead vectorises a single pair: all cells on one anti-diagonal of the DP matrix are independent of each
+ * other, so the inner loop runs over the cells of an anti-diagonal and is auto-vectorised by the compiler.
+ */
+
+// Engine used for the (read, allele) pairs of a single read
+enum class align_mode
+{
+    inter_sequence, // SeqAn, one pair per SIMD lane
+    intra_sequence  // anti-diagonal kernel, one pair at a time
+};
+
+// Below this many pairs, inter-sequence SIMD leaves most lanes empty
+inline constexpr size_t INTRA_SEQ_MAX_PAIRS  = 4;
+// Below this length, anti-diagonals are too short to fill the vector registers
+inline constexpr size_t INTRA_SEQ_MIN_LENGTH = 2048;
+
+inline align_mode selectAlignMode(size_t const nPairs, size_t const lengthH, size_t const lengthV)
+{
+    if (nPairs <= INTRA_SEQ_MAX_PAIRS && std::min(lengthH, lengthV) >= INTRA_SEQ_MIN_LENGTH)
+        return align_mode::intra_sequence;
+    return align_mode::inter_sequence;
+}
+
+// std::max() and std::min() return references, which keeps GCC from vectorising the loops below
+template <typename T>
+inline T maxByValue(T const a, T const b)
+{
+    return a > b ? a : b;
+}
+
+template <typename T>
+inline T minByValue(T const a, T const b)
+{
+    return a < b ? a : b;
+}
+
+struct alignment_scheme
+{
+    int32_t match     = 1;
+    int32_t mismatch  = -1;
+    int32_t gapOpen   = -1; // score of the first position of a gap
+    int32_t gapExtend = -1; // score of every further position of a gap
+
+    bool operator==(alignment_scheme const &) const = default;
+};
+
+/* Banded local alignment score of seqH (columns) against seqV (rows), computed along anti-diagonals.
+ * The semantics match seqan::localAlignmentScore() with a Simple score: a cell is part of the band iff
+ * lowerDiag <= column - row <= upperDiag, and a gap of length k scores gapOpen + (k - 1) * gapExtend.
+ * TValue needs to be able to hold the maximum possible score; see antidiagonalLocalScore() below.
+ *
+ * Scores <= minScore are of no interest to the caller ("no alignment"). As soon as no alignment can exceed minScore
+ * anymore, the computation is abandoned (X-drop) and std::nullopt is returned; the same happens if the final score
+ * is too low. Abandoning is exact, i.e. it never happens for a pair whose score would be above minScore.
+ */
+template <typename TValue, typename TSeqH, typename TSeqV>
+std::optional<int32_t> antidiagonalLocalScoreImpl(TSeqH const &            seqH,
+                                                  TSeqV const &            seqV,
+                                                  alignment_scheme const & scheme,
+                                                  int32_t const            lowerDiag,
+                                                  int32_t const            upperDiag,
+                                                  int32_t const            minScore)
+{
+    int32_t const n = seqan::length(seqH); // columns
+    int32_t const m = seqan::length(seqV); // rows
+
+    if (n == 0 || m == 0)
+        return 0 > minScore ? std::optional<int32_t>{0} : std::nullopt;
+
+    // Low enough to never win a max(), high enough to never overflow when a gap score is added
+    TValue const neg = std::numeric_limits<TValue>::lowest() / 2;
+
+    // The read is stored reversed so that the cells of one anti-diagonal access it contiguously
+    std::vector<uint8_t> v(m);
+    std::vector<uint8_t> hRev(n);
+    for (int32_t i = 0; i < m; ++i)
+        v[i] = seqan::ordValue(seqV[i]);
+    for (int32_t j = 0; j < n; ++j)
+        hRev[n - 1 - j] = seqan::ordValue(seqH[j]);
+
+    // Three anti-diagonals of H and two of E (horizontal gaps) and F (vertical gaps), indexed by row
+    std::vector<TValue> buf(7 * (m + 2), neg);
+    TValue *            h2 = buf.data();
+    TValue *            h1 = h2 + (m + 2);
+    TValue *            h0 = h1 + (m + 2);
+    TValue *            e1 = h0 + (m + 2);
+    TValue *            e0 = e1 + (m + 2);
+    TValue *            f1 = e0 + (m + 2);
+    TValue *            f0 = f1 + (m + 2);
+    std::fill(h2, h2 + 3 * (m + 2), TValue{0}); // first row and column of a local alignment are 0
+
+    TValue const  match     = scheme.match;
+    TValue const  mismatch  = scheme.mismatch;
+    TValue const  gapOpen   = scheme.gapOpen;
+    TValue const  gapExtend = scheme.gapExtend;
+    int32_t const bestStep  = std::max<int32_t>(scheme.match, 0); // upper bound for the gain of a single step
+
+    // Computes the cells of anti-diagonal d; with withBound, also the best score any alignment passing through one
+    // of these cells could still reach
+    auto const computeDiagonal =
+      [&](auto const withBound, int32_t const d, int32_t const lo, int32_t const hi, int32_t & dBound)
+    {
+        uint8_t const * hCol  = hRev.data() + (n - d); // hCol[i] is the character of column d - i
+        TValue          dBest = 0;
+        int32_t         bound = 0;
+
+#pragma omp simd reduction(max : dBest, bound)
+        for (int32_t i = lo; i <= hi; ++i)
+        {
+            TValue const e = maxByValue<TValue>(h1[i] + gapOpen, e1[i] + gapExtend);         // from (i, j-1)
+            TValue const f = maxByValue<TValue>(h1[i - 1] + gapOpen, f1[i - 1] + gapExtend); // from (i-1, j)
+            TValue const s = h2[i - 1] + (v[i - 1] == hCol[i] ? match : mismatch);          // from (i-1, j-1)
+            TValue const h = maxByValue<TValue>(maxByValue<TValue>(s, 0), maxByValue<TValue>(e, f));
+            h0[i]          = h;
+            e0[i]          = e;
+            f0[i]          = f;
+            dBest          = maxByValue(dBest, h);
+            if constexpr (withBound)
+                bound = maxByValue<int32_t>(bound, h + bestStep * minByValue(m - i, n - d + i));
+        }
+
+        dBound = bound;
+        return dBest;
+    };
+
+    int32_t best      = 0;
+    int32_t lastBound = std::numeric_limits<int32_t>::max(); // bound of the previous anti-diagonal
+    bool    started   = false;
+
+    for (int32_t d = 2; d <= m + n; ++d) // d == row + column
+    {
+        // rows on this anti-diagonal that are inside the matrix and inside the band
+        int32_t const lo = std::max({1, d - n, (d - upperDiag + 1) >> 1});
+        int32_t const hi = std::min({m, d - 1, (d - lowerDiag) >> 1});
+
+        if (lo > hi)
+        {
+            if (started) // the band has been left for good
+                break;
+            continue;
+        }
+        started = true;
+
+        // Best score of an alignment that only starts after this anti-diagonal; as long as this is above minScore,
+        // there is no point in computing the (more expensive) bound for alignments crossing the anti-diagonal.
+        int32_t const freshBound = bestStep * (m + n - d + 1) / 2;
+        int32_t       dBound     = std::numeric_limits<int32_t>::max();
+
+        if (freshBound > minScore)
+        {
+            best      = std::max<int32_t>(best, computeDiagonal(std::false_type{}, d, lo, hi, dBound));
+            lastBound = std::numeric_limits<int32_t>::max();
+        }
+        else
+        {
+            best = std::max<int32_t>(best, computeDiagonal(std::true_type{}, d, lo, hi, dBound));
+
+            // every alignment that is not finished yet passes through this or the previous anti-diagonal
+            if (std::max({best, freshBound, dBound, lastBound}) <= minScore)
+                return std::nullopt;
+            lastBound = dBound;
+        }
+
+        // Cells just outside the computed range are read by the next two anti-diagonals; row 0 and column 0 are
+        // the (zero) border of the matrix, everything else is outside of the band.
+        h0[lo - 1] = (lo - 1 == 0) ? 0 : neg;
+        e0[lo - 1] = f0[lo - 1] = neg;
+        h0[hi + 1] = (hi + 1 == d) ? 0 : neg;
+        e0[hi + 1] = f0[hi + 1] = neg;
+
+        std::swap(h2, h1);
+        std::swap(h1, h0);
+        std::swap(e1, e0);
+        std::swap(f1, f0);
+    }
+
+    if (best <= minScore)
+        return std::nullopt;
+    return best;
+}
+
+// Upper bound for the local alignment score of two sequences
+inline int64_t maxLocalScore(size_t const lengthH, size_t const lengthV, alignment_scheme const & scheme)
+{
+    return static_cast<int64_t>(std::max(scheme.match, 0)) * std::min(lengthH, lengthV);
+}
+
+// Chooses the narrowest value type that can hold the best possible score of the pair
+template <typename TSeqH, typename TSeqV>
+std::optional<int32_t> antidiagonalLocalScore(TSeqH const &            seqH,
+                                              TSeqV const &            seqV,
+                                              alignment_scheme const & scheme,
+                                              int32_t const            lowerDiag,
+                                              int32_t const            upperDiag,
+                                              int32_t const minScore = std::numeric_limits<int32_t>::lowest())
+{
+    int64_t const maxScore = maxLocalScore(seqan::length(seqH), seqan::length(seqV), scheme);
+
+    if (maxScore <= minScore)
+        return std::nullopt;
+    else if (maxScore < std::numeric_limits<int16_t>::max() / 2)
+        return antidiagonalLocalScoreImpl<int16_t>(seqH, seqV, scheme, lowerDiag, upperDiag, minScore);
+    else
+        return antidiagonalLocalScoreImpl<int32_t>(seqH, seqV, scheme, lowerDiag, upperDiag, minScore);
+}
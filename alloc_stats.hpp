@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/* Allocation statistics (build with -DLRCALLER_ALLOC_STATS=ON)
+ *
+ * Replaces the global operator new/delete by versions that count allocations, allocated bytes and the peak of live
+ * bytes per stage of the program. The stage of a thread is set with alloc_stage_scope; allocations are attributed to
+ * the stage in which they happen, frees only reduce the live bytes. Counting costs a few atomic operations per
+ * allocation, so this is meant for profiling builds only. In normal builds, alloc_stage_scope does nothing.
+ *
+ * The replacement functions are defined here, because lrcaller.cpp is the only translation unit.
+ */
+
+enum class alloc_stage : uint8_t
+{
+    startup,  // opening files and indexes
+    input,    // reading (and sorting) VCF records
+    fetch,    // reading BAM records of a chunk
+    parse,    // extracting read windows (parseReads)
+    align,    // haplotypes and alignment
+    genotype, // genotyping and FORMAT values
+    output,   // formatting and writing records
+    count
+};
+
+inline constexpr std::array<char const *, (size_t)alloc_stage::count> ALLOC_STAGE_NAMES{
+  "startup", "input", "fetch", "parse", "align", "genotype", "output"};
+
+#ifdef LRCALLER_ALLOC_STATS
+
+#    include <atomic>
+#    include <cstdlib>
+#    include <iomanip>
+#    include <new>
+
+#    include <malloc.h>
+
+struct alloc_counters
+{
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+inline std::array<alloc_counters, (size_t)alloc_stage::count> allocCounters;
+inline std::atomic<int64_t>                                   allocLiveBytes{0};
+inline std::atomic<int64_t>                                   allocPeakBytes{0};
+inline thread_local alloc_stage                               allocStage = alloc_stage::startup;
+
+inline void * countedAlloc(size_t const size)
+{
+    void * ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+        throw std::bad_alloc{};
+
+    // usable size, so that frees (which do not always know the size) subtract the same amount
+    int64_t const usable = malloc_usable_size(ptr);
+    alloc_counters & c   = allocCounters[(size_t)allocStage];
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(usable, std::memory_order_relaxed);
+
+    int64_t const live = allocLiveBytes.fetch_add(usable, std::memory_order_relaxed) + usable;
+    int64_t       peak = allocPeakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !allocPeakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+    {}
+    return ptr;
+}
+
+inline void countedFree(void * const ptr) noexcept
+{
+    if (ptr == nullptr)
+        return;
+    allocLiveBytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    std::free(ptr);
+}
+
+void * operator new(size_t size)
+{
+    return countedAlloc(size);
+}
+void * operator new[](size_t size)
+{
+    return countedAlloc(size);
+}
+void operator delete(void * ptr) noexcept
+{
+    countedFree(ptr);
+}
+void operator delete[](void * ptr) noexcept
+{
+    countedFree(ptr);
+}
+void operator delete(void * ptr, size_t) noexcept
+{
+    countedFree(ptr);
+}
+void operator delete[](void * ptr, size_t) noexcept
+{
+    countedFree(ptr);
+}
+
+// Sets the stage of the current thread until the end of the scope
+class alloc_stage_scope
+{
+public:
+    explicit alloc_stage_scope(alloc_stage const stage) : previous{allocStage} { allocStage = stage; }
+    ~alloc_stage_scope() { allocStage = previous; }
+
+    alloc_stage_scope(alloc_stage_scope const &) = delete;
+    alloc_stage_scope & operator=(alloc_stage_scope const &) = delete;
+
+private:
+    alloc_stage previous;
+};
+
+inline void printAllocStats(std::ostream & out)
+{
+    out << "Allocations by stage:\n" << std::fixed << std::setprecision(1);
+    for (size_t s = 0; s < (size_t)alloc_stage::count; ++s)
+    {
+        out << "  " << std::left << std::setw(9) << ALLOC_STAGE_NAMES[s] << std::right << std::setw(14)
+            << allocCounters[s].allocations.load() << " allocations " << std::setw(10)
+            << allocCounters[s].bytes.load() / double(1 << 20) << " MiB\n";
+    }
+    out << "  peak of live memory: " << allocPeakBytes.load() / double(1 << 20) << " MiB\n";
+}
+
+#else
+
+class alloc_stage_scope
+{
+public:
+    explicit alloc_stage_scope(alloc_stage) {}
+};
+
+inline void printAllocStats(std::ostream &)
+{}
+
+#endif
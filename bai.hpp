@@ -0,0 +1,656 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <seqan/bam_io.h>
+
+#include "misc.hpp"
+
+/* BAM index (BAI)
+ *
+ * seqan::BamIndex<Bai> parses the entire index of every BAM file on opening, and LRcaller used to do so for every
+ * thread. The index below maps the file instead and only parses the bins and the linear index of a contig when that
+ * contig is first fetched from. One index per BAM file is shared by all threads.
+ * The parsed index can also be stored in a flat file that later runs map without parsing (see index_cache.hpp).
+ */
+
+// Read-only memory mapping of a whole file
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    mapped_file(mapped_file const &) = delete;
+    mapped_file & operator=(mapped_file const &) = delete;
+
+    mapped_file(mapped_file && rhs) noexcept
+    {
+        *this = std::move(rhs);
+    }
+
+    mapped_file & operator=(mapped_file && rhs) noexcept
+    {
+        std::swap(data, rhs.data);
+        std::swap(length, rhs.length);
+        return *this;
+    }
+
+    ~mapped_file()
+    {
+        if (data != nullptr)
+            munmap(const_cast<char *>(data), length);
+    }
+
+    void open(std::filesystem::path const & path)
+    {
+        int const fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw error{"Could not open ", path.string(), " for reading."};
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw error{"Could not determine the size of ", path.string()};
+        }
+
+        length = st.st_size;
+        if (length > 0)
+        {
+            void * p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                throw error{"Could not map ", path.string(), " into memory."};
+            data = static_cast<char const *>(p);
+        }
+        else
+        {
+            ::close(fd);
+        }
+    }
+
+    std::span<char const> bytes() const
+    {
+        return {data, length};
+    }
+
+private:
+    char const * data   = nullptr;
+    size_t       length = 0;
+};
+
+// Bounds-checked little-endian reader of the index file
+struct bai_reader
+{
+    std::span<char const> bytes;
+    size_t                pos = 0;
+
+    template <typename T>
+    T read()
+    {
+        if (pos + sizeof(T) > bytes.size())
+            throw error{"BAI index file is truncated."};
+        T value;
+        std::memcpy(&value, bytes.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    void skip(size_t const n)
+    {
+        if (pos + n > bytes.size())
+            throw error{"BAI index file is truncated."};
+        pos += n;
+    }
+};
+
+struct bai_chunk
+{
+    uint64_t begin; // virtual file offsets
+    uint64_t end;
+};
+
+inline constexpr uint32_t BAI_PSEUDO_BIN      = 37450; // holds the number of mapped and unmapped reads
+inline constexpr int32_t  BAI_LINEAR_SHIFT    = 14;    // 16 kb windows of the linear index
+inline constexpr uint64_t BAI_NO_VIRTUAL_OFFS = std::numeric_limits<uint64_t>::max();
+inline constexpr int32_t  BAI_TILE_SHIFT      = 14;    // 16 kb tiles of the auxiliary tile index
+
+/* Auxiliary index of the reads that reach into every 16 kb tile of a contig.
+ * The linear index of a BAI file points to the first read that overlaps a window, which for 100 kb reads is often
+ * far upstream of it; every read in between is decoded just to be thrown away. With the tile index, only the reads
+ * that start before a tile and reach into it are read individually, and sequential reading starts at the tile.
+ */
+struct bai_tiles
+{
+    std::span<uint64_t const> first;      // virtual offset of the first read starting in or after tile t
+    std::span<uint64_t const> spanStarts; // reads that start before tile t and reach into it are
+    std::span<uint64_t const> spanning;   // spanning[spanStarts[t]] to spanning[spanStarts[t + 1]]
+
+    size_t size() const
+    {
+        return first.size();
+    }
+
+    std::span<uint64_t const> spanningReads(size_t const tile) const
+    {
+        return spanning.subspan(spanStarts[tile], spanStarts[tile + 1] - spanStarts[tile]);
+    }
+};
+
+// Bins and linear index of one contig
+struct bai_contig
+{
+    std::span<uint32_t const>  binIds;    // sorted
+    std::span<uint32_t const>  binStarts; // chunks of binIds[i] are chunks[binStarts[i]] to chunks[binStarts[i + 1]]
+    std::span<bai_chunk const> chunks;
+    std::span<uint64_t const>  linear;
+
+    uint64_t nMapped   = 0;
+    uint64_t nUnmapped = 0;
+
+    bai_tiles tiles; // empty unless built by buildTileIndex()
+
+    std::span<bai_chunk const> binChunks(uint32_t const bin) const
+    {
+        auto it = std::ranges::lower_bound(binIds, bin);
+        if (it == binIds.end() || *it != bin)
+            return {};
+        size_t const i = it - binIds.begin();
+        return chunks.subspan(binStarts[i], binStarts[i + 1] - binStarts[i]);
+    }
+};
+
+// Bins that may contain reads overlapping [begin, end) (see SAM specification)
+inline std::vector<uint32_t> reg2bins(int32_t const begin, int32_t end)
+{
+    std::vector<uint32_t> bins{0};
+    --end;
+    for (uint32_t k = 1 + (begin >> 26); k <= 1 + (uint32_t)(end >> 26); ++k)
+        bins.push_back(k);
+    for (uint32_t k = 9 + (begin >> 23); k <= 9 + (uint32_t)(end >> 23); ++k)
+        bins.push_back(k);
+    for (uint32_t k = 73 + (begin >> 20); k <= 73 + (uint32_t)(end >> 20); ++k)
+        bins.push_back(k);
+    for (uint32_t k = 585 + (begin >> 17); k <= 585 + (uint32_t)(end >> 17); ++k)
+        bins.push_back(k);
+    for (uint32_t k = 4681 + (begin >> 14); k <= 4681 + (uint32_t)(end >> 14); ++k)
+        bins.push_back(k);
+    return bins;
+}
+
+// Identifies the BAM and BAI file an index cache file was created from
+struct bai_cache_key
+{
+    uint64_t bamSize  = 0;
+    int64_t  bamMtime = 0;
+    uint64_t baiSize  = 0;
+    int64_t  baiMtime = 0;
+    uint64_t bamHash  = 0; // of the first bytes of the BAM file, which contain its header
+
+    bool operator==(bai_cache_key const &) const = default;
+};
+
+/* Layout of an index cache file: a bai_cache_header, nContigs bai_cache_contigs and then the arrays of every contig.
+ * Offsets are counted from the start of the file and all arrays are 8-byte aligned, so bai_contig can point into a
+ * mapping of the file.
+ */
+inline constexpr char     BAI_CACHE_MAGIC[8] = "LRCBAI\0";
+inline constexpr uint64_t BAI_CACHE_VERSION  = 2;
+inline constexpr uint64_t BAI_CACHE_TILES    = 1; // flag: the file contains the tile index
+
+struct bai_cache_header
+{
+    char          magic[8];
+    uint64_t      version;
+    bai_cache_key key;
+    uint64_t      flags;
+    uint64_t      nContigs;
+};
+
+struct bai_cache_contig
+{
+    uint64_t binIds;
+    uint64_t binStarts;
+    uint64_t chunks;
+    uint64_t linear;
+    uint64_t nBins;
+    uint64_t nChunks;
+    uint64_t nLinear;
+    uint64_t nMapped;
+    uint64_t nUnmapped;
+
+    uint64_t tileFirst;
+    uint64_t tileSpanStarts;
+    uint64_t tileSpanning;
+    uint64_t nTiles;
+    uint64_t nSpanning;
+};
+
+// n elements of T at offset of a mapped index cache file, or nullptr if they are not within the file
+template <typename T>
+inline T const * cachedArray(std::span<char const> const bytes, uint64_t const offset, uint64_t const n)
+{
+    if (offset % alignof(uint64_t) != 0 || offset > bytes.size() || n > (bytes.size() - offset) / sizeof(T))
+        return nullptr;
+    return reinterpret_cast<T const *>(bytes.data() + offset);
+}
+
+class bai_index
+{
+public:
+    void open(std::filesystem::path const & path)
+    {
+        file.open(path);
+
+        bai_reader r{file.bytes()};
+        if (r.bytes.size() < 8 || std::memcmp(r.bytes.data(), "BAI\1", 4) != 0)
+            throw error{path.string(), " is not a BAI index file."};
+        r.skip(4);
+
+        int32_t const nRef = r.read<int32_t>();
+        if (nRef < 0)
+            throw error{path.string(), " is not a BAI index file."};
+
+        lazy             = std::make_unique<lazy_state>();
+        lazy->refOffsets = {r.pos};
+        lazy->parsed     = std::make_unique<std::once_flag[]>(nRef);
+        lazy->contigs    = std::vector<bai_contig>(nRef);
+        lazy->storage    = std::vector<contig_storage>(nRef);
+        nContigs         = nRef;
+        tiled            = false;
+    }
+
+    // Maps an index cache file written by writeCache(); returns false if it is missing, stale or damaged
+    bool openCache(std::filesystem::path const & path, bai_cache_key const & key)
+    {
+        if (!std::filesystem::exists(path))
+            return false;
+
+        mapped_file cache;
+        cache.open(path);
+        std::span<char const> const bytes = cache.bytes();
+
+        bai_cache_header header;
+        if (bytes.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, BAI_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != BAI_CACHE_VERSION || !(header.key == key) ||
+            header.nContigs > (bytes.size() - sizeof(header)) / sizeof(bai_cache_contig))
+            return false;
+
+        auto state     = std::make_unique<lazy_state>();
+        state->contigs = std::vector<bai_contig>(header.nContigs);
+        state->storage = std::vector<contig_storage>(header.nContigs);
+        for (size_t i = 0; i < header.nContigs; ++i)
+        {
+            bai_cache_contig cc;
+            std::memcpy(&cc, bytes.data() + sizeof(header) + i * sizeof(cc), sizeof(cc));
+
+            uint32_t const *  binIds    = cachedArray<uint32_t>(bytes, cc.binIds, cc.nBins);
+            uint32_t const *  binStarts = cachedArray<uint32_t>(bytes, cc.binStarts, cc.nBins + 1);
+            bai_chunk const * chunks    = cachedArray<bai_chunk>(bytes, cc.chunks, cc.nChunks);
+            uint64_t const *  linear    = cachedArray<uint64_t>(bytes, cc.linear, cc.nLinear);
+            if (!binIds || !binStarts || !chunks || !linear || binStarts[cc.nBins] != cc.nChunks)
+                return false;
+
+            uint64_t const   nSpanStarts    = cc.nTiles > 0 ? cc.nTiles + 1 : 0;
+            uint64_t const * tileFirst      = cachedArray<uint64_t>(bytes, cc.tileFirst, cc.nTiles);
+            uint64_t const * tileSpanStarts = cachedArray<uint64_t>(bytes, cc.tileSpanStarts, nSpanStarts);
+            uint64_t const * tileSpanning   = cachedArray<uint64_t>(bytes, cc.tileSpanning, cc.nSpanning);
+            if (!tileFirst || !tileSpanStarts || !tileSpanning ||
+                (cc.nTiles > 0 && tileSpanStarts[cc.nTiles] != cc.nSpanning))
+                return false;
+
+            bai_contig & c = state->contigs[i];
+            c.binIds       = {binIds, cc.nBins};
+            c.binStarts    = {binStarts, cc.nBins + 1};
+            c.chunks       = {chunks, cc.nChunks};
+            c.linear       = {linear, cc.nLinear};
+            c.nMapped      = cc.nMapped;
+            c.nUnmapped    = cc.nUnmapped;
+            c.tiles        = {{tileFirst, cc.nTiles}, {tileSpanStarts, nSpanStarts}, {tileSpanning, cc.nSpanning}};
+        }
+
+        file     = std::move(cache);
+        lazy     = std::move(state);
+        nContigs = header.nContigs;
+        tiled    = header.flags & BAI_CACHE_TILES;
+        return true;
+    }
+
+    /* Parses all contigs and writes them to an index cache file. The file is written under a temporary name and
+     * renamed afterwards, so that concurrent runs never map an incomplete file.
+     */
+    void writeCache(std::filesystem::path const & path, bai_cache_key const & key) const
+    {
+        bai_cache_header header{};
+        std::memcpy(header.magic, BAI_CACHE_MAGIC, sizeof(header.magic));
+        header.version  = BAI_CACHE_VERSION;
+        header.key      = key;
+        header.flags    = tiled ? BAI_CACHE_TILES : 0;
+        header.nContigs = nContigs;
+
+        auto const padded = [](uint64_t const n) { return (n + 7) / 8 * 8; };
+
+        std::vector<bai_cache_contig> table(nContigs);
+        uint64_t                      offset = sizeof(header) + nContigs * sizeof(bai_cache_contig);
+        for (size_t i = 0; i < nContigs; ++i)
+        {
+            bai_contig const & c  = contig(i);
+            bai_cache_contig & cc = table[i];
+            cc.nBins              = c.binIds.size();
+            cc.nChunks            = c.chunks.size();
+            cc.nLinear            = c.linear.size();
+            cc.nMapped            = c.nMapped;
+            cc.nUnmapped          = c.nUnmapped;
+            cc.nTiles             = c.tiles.first.size();
+            cc.nSpanning          = c.tiles.spanning.size();
+
+            cc.binIds         = offset;
+            offset           += padded(c.binIds.size_bytes());
+            cc.binStarts      = offset;
+            offset           += padded(c.binStarts.size_bytes());
+            cc.chunks         = offset;
+            offset           += padded(c.chunks.size_bytes());
+            cc.linear         = offset;
+            offset           += padded(c.linear.size_bytes());
+            cc.tileFirst      = offset;
+            offset           += padded(c.tiles.first.size_bytes());
+            cc.tileSpanStarts = offset;
+            offset           += padded(c.tiles.spanStarts.size_bytes());
+            cc.tileSpanning   = offset;
+            offset           += padded(c.tiles.spanning.size_bytes());
+        }
+
+        std::filesystem::path tmp = path;
+        tmp += ".tmp" + std::to_string(getpid());
+
+        std::ofstream out{tmp, std::ios::binary};
+        auto const    write = [&](auto const & bytes)
+        {
+            static constexpr char zeros[8] = {};
+            out.write(reinterpret_cast<char const *>(bytes.data()), bytes.size_bytes());
+            out.write(zeros, padded(bytes.size_bytes()) - bytes.size_bytes());
+        };
+
+        out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        out.write(reinterpret_cast<char const *>(table.data()), table.size() * sizeof(bai_cache_contig));
+        for (size_t i = 0; i < nContigs; ++i)
+        {
+            bai_contig const & c = contig(i);
+            write(c.binIds);
+            write(c.binStarts);
+            write(c.chunks);
+            write(c.linear);
+            write(c.tiles.first);
+            write(c.tiles.spanStarts);
+            write(c.tiles.spanning);
+        }
+
+        if (!out.flush())
+        {
+            out.close();
+            std::filesystem::remove(tmp);
+            throw error{"Could not write index cache file ", tmp.string()};
+        }
+        out.close();
+        std::filesystem::rename(tmp, path);
+    }
+
+    // Sets the tile index of contig rID; first, spanStarts and spanning as described for bai_tiles
+    void setTiles(int32_t const           rID,
+                  std::vector<uint64_t> && first,
+                  std::vector<uint64_t> && spanStarts,
+                  std::vector<uint64_t> && spanning)
+    {
+        contig(rID); // the bins must not be parsed afterwards
+        contig_storage & s = lazy->storage[rID];
+        s.tileFirst        = std::move(first);
+        s.tileSpanStarts   = std::move(spanStarts);
+        s.tileSpanning     = std::move(spanning);
+
+        lazy->contigs[rID].tiles = {s.tileFirst, s.tileSpanStarts, s.tileSpanning};
+        tiled                    = true;
+    }
+
+    // Whether the tile index has been built or loaded
+    bool hasTiles() const
+    {
+        return tiled;
+    }
+
+    size_t size() const
+    {
+        return nContigs;
+    }
+
+    // Bins and linear index of contig rID; parsed on first access unless loaded from a cache file
+    bai_contig const & contig(int32_t const rID) const
+    {
+        if (lazy->parsed)
+            std::call_once(lazy->parsed[rID], [&] { parseContig(rID); });
+        return lazy->contigs[rID];
+    }
+
+    // Virtual offset from which all reads of contig rID overlapping [begin, end) can be read, or BAI_NO_VIRTUAL_OFFS
+    uint64_t startOffset(int32_t const rID, int32_t const begin, int32_t const end) const
+    {
+        bai_contig const & c = contig(rID);
+
+        uint64_t const minOffset =
+          c.linear.empty() ? 0 : c.linear[std::min<size_t>(begin >> BAI_LINEAR_SHIFT, c.linear.size() - 1)];
+
+        uint64_t start = BAI_NO_VIRTUAL_OFFS;
+        for (uint32_t const bin : reg2bins(begin, end))
+            for (bai_chunk const & chunk : c.binChunks(bin))
+                if (chunk.end > minOffset)
+                    start = std::min(start, std::max(chunk.begin, minOffset));
+
+        return start;
+    }
+
+private:
+    struct contig_storage
+    {
+        std::vector<uint32_t>  binIds;
+        std::vector<uint32_t>  binStarts;
+        std::vector<bai_chunk> chunks;
+        std::vector<uint64_t>  linear;
+
+        std::vector<uint64_t> tileFirst;
+        std::vector<uint64_t> tileSpanStarts;
+        std::vector<uint64_t> tileSpanning;
+    };
+
+    struct lazy_state
+    {
+        std::mutex                        mutex;
+        std::vector<size_t>               refOffsets; // start of the data of every contig, as far as known
+        std::unique_ptr<std::once_flag[]> parsed; // nullptr if loaded from a cache file
+        std::vector<bai_contig>           contigs;
+        std::vector<contig_storage>       storage;
+    };
+
+    mapped_file                 file;
+    size_t                      nContigs = 0;
+    bool                        tiled    = false;
+    std::unique_ptr<lazy_state> lazy;
+
+    // Skips the data of one contig and returns the position behind it
+    static size_t skipContig(bai_reader r)
+    {
+        int32_t const nBins = r.read<int32_t>();
+        for (int32_t b = 0; b < nBins; ++b)
+        {
+            r.skip(sizeof(uint32_t));
+            r.skip(r.read<int32_t>() * sizeof(bai_chunk));
+        }
+        r.skip(r.read<int32_t>() * sizeof(uint64_t));
+        return r.pos;
+    }
+
+    // Finds the start of the data of contig rID; contigs are stored consecutively without an offset table
+    size_t contigOffset(int32_t const rID) const
+    {
+        std::lock_guard lock{lazy->mutex};
+        std::vector<size_t> & offsets = lazy->refOffsets;
+        while (offsets.size() <= (size_t)rID)
+            offsets.push_back(skipContig(bai_reader{file.bytes(), offsets.back()}));
+        return offsets[rID];
+    }
+
+    void parseContig(int32_t const rID) const
+    {
+        bai_reader       r{file.bytes(), contigOffset(rID)};
+        contig_storage & s = lazy->storage[rID];
+        bai_contig &     c = lazy->contigs[rID];
+
+        int32_t const nBins = r.read<int32_t>();
+        std::vector<std::pair<uint32_t, std::vector<bai_chunk>>> bins;
+        bins.reserve(nBins);
+        for (int32_t b = 0; b < nBins; ++b)
+        {
+            uint32_t const bin     = r.read<uint32_t>();
+            int32_t const  nChunks = r.read<int32_t>();
+
+            if (bin == BAI_PSEUDO_BIN)
+            {
+                r.skip(sizeof(bai_chunk)); // virtual offsets of the unmapped reads
+                c.nMapped   = r.read<uint64_t>();
+                c.nUnmapped = r.read<uint64_t>();
+                r.skip((nChunks - 2) * sizeof(bai_chunk));
+                continue;
+            }
+
+            std::vector<bai_chunk> chunks(nChunks);
+            for (bai_chunk & chunk : chunks)
+            {
+                chunk.begin = r.read<uint64_t>();
+                chunk.end   = r.read<uint64_t>();
+            }
+            bins.emplace_back(bin, std::move(chunks));
+        }
+        std::ranges::sort(bins, {}, &std::pair<uint32_t, std::vector<bai_chunk>>::first);
+
+        for (auto & [bin, chunks] : bins)
+        {
+            s.binIds.push_back(bin);
+            s.binStarts.push_back(s.chunks.size());
+            s.chunks.insert(s.chunks.end(), chunks.begin(), chunks.end());
+        }
+        s.binStarts.push_back(s.chunks.size());
+
+        int32_t const nIntervals = r.read<int32_t>();
+        s.linear.resize(nIntervals);
+        for (uint64_t & offset : s.linear)
+            offset = r.read<uint64_t>();
+
+        c.binIds    = s.binIds;
+        c.binStarts = s.binStarts;
+        c.chunks    = s.chunks;
+        c.linear    = s.linear;
+    }
+};
+
+inline constexpr uint64_t BGZF_MAX_BLOCK_SIZE = 1 << 16;
+
+/* Range of (compressed) file offsets that fetchRecords() reads for [begin, end), or an empty range. Coarse bins can
+ * have chunks far behind the region, so the range is limited to maxBytes.
+ */
+inline std::pair<uint64_t, uint64_t> regionFileRange(bai_index const & index,
+                                                     int32_t const     rID,
+                                                     int32_t const     begin,
+                                                     int32_t const     end,
+                                                     uint64_t const    maxBytes)
+{
+    if (rID < 0 || (size_t)rID >= index.size() || begin >= end || index.contig(rID).chunks.empty())
+        return {0, 0};
+
+    uint64_t const start = index.startOffset(rID, begin, end);
+    if (start == BAI_NO_VIRTUAL_OFFS)
+        return {0, 0};
+
+    uint64_t last = start;
+    for (uint32_t const bin : reg2bins(begin, end))
+        for (bai_chunk const & chunk : index.contig(rID).binChunks(bin))
+            if (chunk.end > start)
+                last = std::max(last, chunk.end);
+
+    uint64_t const first = start >> 16;
+    return {first, std::min((last >> 16) + BGZF_MAX_BLOCK_SIZE, first + maxBytes)};
+}
+
+/* Appends all records of contig rID that overlap [begin, end) to records.
+ * This replaces seqan::viewRecords(), which needs a seqan::BamIndex. If the index has a tile index, reads that end
+ * before the tile of begin are never decoded.
+ */
+template <typename TRecords>
+inline void fetchRecords(TRecords &          records,
+                         seqan::BamFileIn &  bamFile,
+                         bai_index const &   index,
+                         int32_t const       rID,
+                         int32_t const       begin,
+                         int32_t const       end)
+{
+    if (rID < 0 || (size_t)rID >= index.size() || begin >= end)
+        return;
+
+    if (index.contig(rID).chunks.empty()) // no reads on this contig
+        return;
+
+    seqan::BamAlignmentRecord record;
+    uint64_t                  start = BAI_NO_VIRTUAL_OFFS;
+
+    if (index.hasTiles())
+    {
+        bai_tiles const & tiles = index.contig(rID).tiles;
+        size_t const tile = begin >> BAI_TILE_SHIFT;
+        if (tile >= tiles.size()) // no read reaches this far
+            return;
+
+        // reads from upstream tiles are read individually, in file order
+        for (uint64_t const offset : tiles.spanningReads(tile))
+        {
+            seqan::setPosition(bamFile, offset);
+            seqan::readRecord(record, bamFile);
+            if (record.beginPos + (int32_t)seqan::getAlignmentLengthInRef(record) > begin)
+                records.push_back(record);
+        }
+
+        start = tiles.first[tile];
+    }
+    else
+    {
+        start = index.startOffset(rID, begin, end);
+    }
+
+    if (start == BAI_NO_VIRTUAL_OFFS)
+        return;
+
+    seqan::setPosition(bamFile, start);
+
+    while (!seqan::atEnd(bamFile))
+    {
+        seqan::readRecord(record, bamFile);
+        if (record.rID != rID || record.beginPos >= end)
+            break;
+
+        if (record.beginPos + (int32_t)seqan::getAlignmentLengthInRef(record) > begin)
+            records.push_back(record);
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <seqan/bam_io.h>
+#include <seqan/seq_io.h>
+#include <seqan/sequence.h>
+
+/* Translation of contig IDs
+ *
+ * VCF, reference FASTA and every BAM file number their contigs independently, and may even name them differently
+ * (e.g. "chr1" vs "1"). Instead of looking up names for every chunk and variant, the IDs of every VCF contig in the
+ * FAI and in each BAM file are resolved once and stored in a dense table indexed by the VCF rID.
+ */
+
+inline constexpr uint32_t NO_CONTIG = std::numeric_limits<uint32_t>::max();
+
+// The name itself, followed by the names other resources commonly use for the same contig
+inline std::vector<seqan::CharString> contigAliases(std::string const & name)
+{
+    std::vector<seqan::CharString> aliases{name.c_str()};
+
+    if (name.starts_with("chr"))
+    {
+        aliases.push_back(name.substr(3).c_str());
+        if (name == "chrM")
+            aliases.push_back("MT");
+    }
+    else
+    {
+        aliases.push_back(("chr" + name).c_str());
+        if (name == "MT")
+            aliases.push_back("chrM");
+        else if (name == "M")
+            aliases.push_back("MT");
+    }
+
+    return aliases;
+}
+
+class contig_table
+{
+public:
+    contig_table() = default;
+
+    explicit contig_table(size_t const nBams) : nBams{nBams} {}
+
+    // ID of VCF contig rID in the FAI, or NO_CONTIG
+    uint32_t faiId(int32_t const rID) const
+    {
+        return faiIds[rID];
+    }
+
+    // ID of VCF contig rID in BAM file bam, or NO_CONTIG
+    uint32_t bamId(int32_t const rID, size_t const bam) const
+    {
+        return bamIds[rID * nBams + bam];
+    }
+
+    size_t size() const
+    {
+        return faiIds.size();
+    }
+
+    // Resolves all contigs of vcfContigs that are not part of the table yet
+    template <typename TNameStore>
+    void update(TNameStore const &                    vcfContigs,
+                seqan::FaiIndex const &               faIndex,
+                std::vector<seqan::BamFileIn> const & bamFiles)
+    {
+        for (size_t rID = faiIds.size(); rID < length(vcfContigs); ++rID)
+        {
+            std::vector<seqan::CharString> const aliases = contigAliases(seqan::toCString(vcfContigs[rID]));
+
+            uint32_t faiId = NO_CONTIG;
+            for (seqan::CharString const & alias : aliases)
+            {
+                unsigned id = 0;
+                if (seqan::getIdByName(id, faIndex, alias))
+                {
+                    faiId = id;
+                    break;
+                }
+            }
+            faiIds.push_back(faiId);
+
+            for (seqan::BamFileIn const & bamFile : bamFiles)
+            {
+                uint32_t bamId = NO_CONTIG;
+                for (seqan::CharString const & alias : aliases)
+                {
+                    size_t id = 0;
+                    if (seqan::getIdByName(id, seqan::contigNamesCache(seqan::context(bamFile)), alias))
+                    {
+                        bamId = id;
+                        break;
+                    }
+                }
+                bamIds.push_back(bamId);
+            }
+
+            names.push_back(aliases[0]);
+            reported.push_back(false);
+        }
+    }
+
+    // Reports (once) if a contig that has variants is missing from the reference or from all BAM files
+    void reportIfMissing(int32_t const rID)
+    {
+        if (reported[rID])
+            return;
+        reported[rID] = true;
+
+        bool inAnyBam = false;
+        for (size_t bam = 0; bam < nBams; ++bam)
+            inAnyBam |= bamId(rID, bam) != NO_CONTIG;
+
+        if (faiId(rID) == NO_CONTIG)
+            std::cerr << "WARNING: Contig " << names[rID]
+                      << " is not part of the reference; its variants cannot be genotyped.\n";
+        else if (!inAnyBam)
+            std::cerr << "WARNING: Contig " << names[rID] << " is not part of any BAM file.\n";
+    }
+
+private:
+    size_t                nBams = 0;
+    std::vector<uint32_t> faiIds; // by VCF rID
+    std::vector<uint32_t> bamIds; // by VCF rID and BAM file
+
+    std::vector<seqan::CharString> names;
+    std::vector<bool>              reported;
+};
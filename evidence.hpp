@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <seqan/vcf_io.h>
+
+#include "index_cache.hpp"
+#include "misc.hpp"
+#include "options.hpp"
+
+/* Evidence files (--save-evidence, --load-evidence)
+ *
+ * When a sample is sequenced again, its new reads only add to the evidence of the old ones. With --save-evidence,
+ * the accumulated evidence of every record (genotype likelihoods, allele depths and supporting read names per
+ * genotyping model, as summed by multiUpdateVC(), and hashes of the names of all reads counted) is written to a
+ * file. A later run on only the new BAM files with --load-evidence adds the new reads to that evidence and reports
+ * the combined result; reads whose name was already counted (e.g. in merged BAM files) are skipped. Both options can
+ * be given, to save the combined evidence again.
+ *
+ * The file has one tab-separated line per record: CHROM, POS, REF and ALT, then the likelihoods, allele depths and
+ * alignment counts (values separated by ',' and models by ';'), the read names per allele (separated by ' ') and
+ * the read name hashes (hexadecimal, separated by ',').
+ */
+
+inline constexpr std::string_view EVIDENCE_FILE_HEADER = "##lrcaller-evidence=1";
+
+// The number of models that genotypeVariant() evaluates
+inline size_t genotypingModelCount(genotyping_model const gtModel)
+{
+    return gtModel == genotyping_model::multi ? 5 : 1;
+}
+
+struct variant_evidence
+{
+    std::vector<std::vector<double>> vC;         // genotype likelihoods, per model
+    std::vector<std::vector<size_t>> AD;         // allele depths, per model
+    std::vector<std::vector<size_t>> VA;         // allele counts from the CIGAR strings, per model
+    std::vector<std::string>         qnames;     // names of the reads supporting each allele, as ",name,name"
+    std::vector<uint64_t>            readHashes; // hashes of the names of all reads counted, sorted
+
+    bool empty() const { return vC.empty(); }
+};
+
+inline uint64_t readNameHash(std::string_view const name)
+{
+    return fnv1a(name);
+}
+
+// The part of a line of an evidence file that identifies the record
+inline std::string evidenceKey(seqan::CharString const & chrom, seqan::VcfRecord const & var)
+{
+    std::string key{toCString(chrom)};
+    key += '\t';
+    key += std::to_string(var.beginPos + 1);
+    key += '\t';
+    key += toCString(var.ref);
+    key += '\t';
+    key += toCString(var.alt);
+    return key;
+}
+
+namespace detail
+{
+
+template <typename number_t>
+inline void appendNumbers(std::string & out, std::vector<std::vector<number_t>> const & models)
+{
+    out += '\t';
+    for (size_t m = 0; m < models.size(); ++m)
+    {
+        for (size_t i = 0; i < models[m].size(); ++i)
+        {
+            char       buffer[32];
+            auto const res = std::to_chars(buffer, buffer + sizeof(buffer), models[m][i]);
+            if (i > 0)
+                out += ',';
+            out.append(buffer, res.ptr);
+        }
+        if (m + 1 < models.size())
+            out += ';';
+    }
+}
+
+inline std::vector<std::string_view> splitView(std::string_view text, char const separator)
+{
+    std::vector<std::string_view> parts;
+    for (size_t end; (end = text.find(separator)) != std::string_view::npos; text.remove_prefix(end + 1))
+        parts.push_back(text.substr(0, end));
+    parts.push_back(text);
+    return parts;
+}
+
+template <typename number_t>
+inline bool parseNumber(std::string_view const text, number_t & value, int const base = 10)
+{
+    std::from_chars_result res;
+    if constexpr (std::is_floating_point_v<number_t>)
+        res = std::from_chars(text.data(), text.data() + text.size(), value);
+    else
+        res = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return res.ec == std::errc{} && res.ptr == text.data() + text.size();
+}
+
+template <typename number_t>
+inline bool parseNumbers(std::string_view const text, std::vector<std::vector<number_t>> & models)
+{
+    for (std::string_view const model : splitView(text, ';'))
+    {
+        models.emplace_back();
+        for (std::string_view const value : splitView(model, ','))
+            if (!parseNumber(value, models.back().emplace_back()))
+                return false;
+    }
+    return true;
+}
+
+} // namespace detail
+
+// Appends the line of a record to out
+inline void writeEvidence(std::string & out, std::string_view const key, variant_evidence const & evidence)
+{
+    out += key;
+    detail::appendNumbers(out, evidence.vC);
+    detail::appendNumbers(out, evidence.AD);
+    detail::appendNumbers(out, evidence.VA);
+
+    out += '\t';
+    for (size_t i = 0; i < evidence.qnames.size(); ++i)
+    {
+        if (i > 0)
+            out += ' ';
+        out += evidence.qnames[i];
+    }
+
+    out += '\t';
+    for (size_t i = 0; i < evidence.readHashes.size(); ++i)
+    {
+        char       buffer[16];
+        auto const res = std::to_chars(buffer, buffer + sizeof(buffer), evidence.readHashes[i], 16);
+        if (i > 0)
+            out += ',';
+        out.append(buffer, res.ptr);
+    }
+    out += '\n';
+}
+
+// Evidence of all records of an evidence file, by evidenceKey()
+class evidence_store
+{
+public:
+    void load(std::filesystem::path const & path, size_t const nModels)
+    {
+        std::ifstream in{path};
+        std::string   line;
+        if (!in || !std::getline(in, line) || line != EVIDENCE_FILE_HEADER)
+            throw error{"Could not read the evidence file ", path.string(), "."};
+
+        for (size_t lineNo = 2; std::getline(in, line); ++lineNo)
+        {
+            std::vector<std::string_view> const fields = detail::splitView(line, '\t');
+
+            variant_evidence evidence;
+            bool             valid = fields.size() == 9 && detail::parseNumbers(fields[4], evidence.vC) &&
+                             detail::parseNumbers(fields[5], evidence.AD) &&
+                             detail::parseNumbers(fields[6], evidence.VA) && evidence.vC.size() == nModels &&
+                             evidence.AD.size() == nModels && evidence.VA.size() == nModels;
+
+            if (valid)
+            {
+                for (std::string_view const qnames : detail::splitView(fields[7], ' '))
+                    evidence.qnames.emplace_back(qnames);
+                valid = evidence.qnames.size() == evidence.AD[0].size();
+            }
+            if (valid && !fields[8].empty())
+                for (std::string_view const hash : detail::splitView(fields[8], ','))
+                    valid &= detail::parseNumber(hash, evidence.readHashes.emplace_back(), 16);
+
+            if (!valid)
+                throw error{"Invalid line ", lineNo, " in ", path.string(),
+                            " (or it was written with another genotyping model)."};
+
+            std::ranges::sort(evidence.readHashes);
+            std::string key{fields[0]};
+            for (size_t i = 1; i < 4; ++i)
+                (key += '\t') += fields[i];
+            records.insert_or_assign(std::move(key), std::move(evidence));
+        }
+    }
+
+    bool empty() const { return records.empty(); }
+
+    // The stored evidence of a record, or nullptr
+    variant_evidence const * find(std::string const & key) const
+    {
+        auto const it = records.find(key);
+        return it == records.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::unordered_map<std::string, variant_evidence> records;
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bai.hpp"
+#include "options.hpp"
+
+/* Persistent index cache
+ *
+ * Deep long-read BAM files come with index files of hundreds of MB, which every run used to read and parse again.
+ * With --index-cache-dir, the parsed index of every BAM file is written to a flat file (see bai_cache_header) once.
+ * Later runs, and concurrent processes, map that file read-only and point the contigs of bai_index into it. Cache
+ * files are named after and validated against the size and modification time of BAM and BAI file and a hash of the
+ * BAM header, so a changed BAM file is never paired with a stale index.
+ * With --tile-index, the cache file also contains the tile index (see bai_tiles), which can only be built by reading
+ * the whole BAM file once.
+ */
+
+inline uint64_t fnv1a(std::string_view const bytes, uint64_t hash = 14695981039346656037ull)
+{
+    for (char const c : bytes)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline bai_cache_key indexCacheKey(std::filesystem::path const & bamPath, std::filesystem::path const & baiPath)
+{
+    auto const mtime = [](std::filesystem::path const & p)
+    { return static_cast<int64_t>(std::filesystem::last_write_time(p).time_since_epoch().count()); };
+
+    bai_cache_key key;
+    key.bamSize  = std::filesystem::file_size(bamPath);
+    key.bamMtime = mtime(bamPath);
+    key.baiSize  = std::filesystem::file_size(baiPath);
+    key.baiMtime = mtime(baiPath);
+
+    // the header of a BAM file is at its beginning; reading further is not worth it
+    std::array<char, 65536> head;
+    std::ifstream           in{bamPath, std::ios::binary};
+    in.read(head.data(), head.size());
+    key.bamHash = fnv1a({head.data(), static_cast<size_t>(in.gcount())});
+
+    return key;
+}
+
+inline std::filesystem::path indexCacheFile(std::filesystem::path const & cacheDir,
+                                            std::filesystem::path const & bamPath,
+                                            bai_cache_key const &         key)
+{
+    char hash[17];
+    std::snprintf(hash,
+                  sizeof(hash),
+                  "%016llx",
+                  static_cast<unsigned long long>(
+                    fnv1a({reinterpret_cast<char const *>(&key), sizeof(key)})));
+    return cacheDir / (bamPath.filename().string() + '.' + hash + ".lrcidx");
+}
+
+// Builds the tile index of bamPath by reading all of its records once
+inline void buildTileIndex(bai_index & index, std::filesystem::path const & bamPath)
+{
+    seqan::BamFileIn bamFile;
+    if (!open(bamFile, bamPath.c_str()))
+        throw error{"Could not open ", bamPath.string(), " for reading."};
+
+    seqan::BamHeader header;
+    readHeader(header, bamFile);
+
+    struct tile_builder
+    {
+        std::vector<uint64_t>                      first;
+        std::vector<std::pair<uint64_t, uint64_t>> spanning; // tile and virtual offset of the read
+    };
+    std::vector<tile_builder> builders(index.size());
+
+    seqan::BamAlignmentRecord record;
+    while (!atEnd(bamFile))
+    {
+        uint64_t const offset = seqan::position(bamFile);
+        readRecord(record, bamFile);
+        if (record.rID < 0 || (size_t)record.rID >= index.size()) // unplaced reads are at the end
+            break;
+
+        int32_t const end       = record.beginPos + std::max<int32_t>(getAlignmentLengthInRef(record), 1);
+        size_t const  firstTile = record.beginPos >> BAI_TILE_SHIFT;
+        size_t const  lastTile  = (end - 1) >> BAI_TILE_SHIFT;
+
+        tile_builder & b = builders[record.rID];
+        while (b.first.size() <= firstTile)
+            b.first.push_back(offset);
+        for (size_t tile = firstTile + 1; tile <= lastTile; ++tile)
+            b.spanning.emplace_back(tile, offset);
+    }
+
+    for (size_t rID = 0; rID < builders.size(); ++rID)
+    {
+        tile_builder & b = builders[rID];
+        std::ranges::stable_sort(b.spanning, {}, &std::pair<uint64_t, uint64_t>::first);
+
+        // reads may reach into tiles behind the start of the last read
+        size_t const nTiles = std::max<size_t>(b.first.size(), b.spanning.empty() ? 0 : b.spanning.back().first + 1);
+        b.first.resize(nTiles, BAI_NO_VIRTUAL_OFFS);
+
+        std::vector<uint64_t> spanStarts(nTiles > 0 ? nTiles + 1 : 0, 0);
+        std::vector<uint64_t> spanning;
+        spanning.reserve(b.spanning.size());
+        for (auto const & [tile, offset] : b.spanning)
+        {
+            ++spanStarts[tile + 1];
+            spanning.push_back(offset);
+        }
+        for (size_t tile = 1; tile < spanStarts.size(); ++tile)
+            spanStarts[tile] += spanStarts[tile - 1];
+
+        index.setTiles(rID, std::move(b.first), std::move(spanStarts), std::move(spanning));
+        b = {};
+    }
+}
+
+// Opens the index of bamPath, from the index cache if possible; a missing or stale cache file is (re)created
+inline void openBamIndex(bai_index & index, std::filesystem::path const & bamPath, LRCOptions const & O)
+{
+    std::filesystem::path baiPath = bamPath;
+    baiPath += ".bai";
+
+    if (O.indexCacheDir.empty())
+    {
+        index.open(baiPath);
+        return;
+    }
+
+    bai_cache_key const         key       = indexCacheKey(bamPath, baiPath);
+    std::filesystem::path const cachePath = indexCacheFile(O.indexCacheDir, bamPath, key);
+    bool const                  cached    = index.openCache(cachePath, key);
+    if (cached && (index.hasTiles() || !O.tileIndex))
+    {
+        if (O.verbose)
+            std::cerr << "Using cached index " << cachePath << '\n';
+        return;
+    }
+
+    if (!cached)
+        index.open(baiPath);
+
+    if (O.tileIndex)
+    {
+        if (O.verbose)
+            std::cerr << "Building the tile index of " << bamPath << '\n';
+        buildTileIndex(index, bamPath);
+    }
+
+    // the cache only saves time, so failing to write it is not an error
+    try
+    {
+        std::filesystem::create_directories(O.indexCacheDir);
+        index.writeCache(cachePath, key);
+        if (O.verbose)
+            std::cerr << "Wrote cached index " << cachePath << '\n';
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "WARNING: Could not write the index cache: " << e.what() << '\n';
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/* Tracing of the genotyping (build with -DLRCALLER_ENABLE_TRACE=ON)
+ *
+ * The messages of --verbose about single records, reads and CIGAR operations are written with LRC_DEBUG() and
+ * LRC_TRACE(). In normal builds, these expand to nothing, so the hot loops carry no checks of the verbosity. In builds
+ * with LRCALLER_ENABLE_TRACE, every thread writes its messages to its own buffer, without locking; the buffer of a
+ * chunk is taken with takeLog() when the chunk is done and written by the main thread in chunk order, so the output
+ * is the same for any number of threads.
+ *
+ * Levels: debug (per record and read, enabled by --verbose) and trace (per CIGAR operation, enabled by --trace).
+ */
+
+enum class log_level : uint8_t
+{
+    off,
+    debug,
+    trace
+};
+
+#ifdef LRCALLER_ENABLE_TRACE
+
+inline log_level logLevel = log_level::off; // set once, before any threads are started
+
+inline std::ostringstream & logBuffer()
+{
+    thread_local std::ostringstream buffer;
+    return buffer;
+}
+
+inline void setLogLevel(log_level const level)
+{
+    logLevel = level;
+}
+
+// Returns and clears the messages of the current thread
+inline std::string takeLog()
+{
+    std::string messages = logBuffer().str();
+    logBuffer().str(std::string{});
+    return messages;
+}
+
+#    define LRC_LOG(level, message)                                                                                   \
+        do                                                                                                             \
+        {                                                                                                              \
+            if (logLevel >= (level))                                                                                   \
+                logBuffer() << message << '\n';                                                                        \
+        }                                                                                                              \
+        while (false)
+
+#else
+
+inline void setLogLevel(log_level)
+{}
+
+inline std::string takeLog()
+{
+    return {};
+}
+
+#    define LRC_LOG(level, message)                                                                                   \
+        do                                                                                                             \
+        {}                                                                                                             \
+        while (false)
+
+#endif
+
+#define LRC_DEBUG(message) LRC_LOG(log_level::debug, message)
+#define LRC_TRACE(message) LRC_LOG(log_level::trace, message)
@@ -3,57 +3,195 @@
 inline size_t lrcaller_bgzf_threads = 1;
 #define SEQAN_BGZF_NUM_THREADS lrcaller_bgzf_threads
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <string_view>
+
+#include "affinity.hpp"
+#include "alloc_stats.hpp"
 #include "algo.hpp"
+#include "contig_table.hpp"
+#include "index_cache.hpp"
+#include "log.hpp"
 #include "misc.hpp"
+#include "mpi_ranks.hpp"
 #include "options.hpp"
+#include "passthrough.hpp"
+#include "plan.hpp"
+#include "result_cache.hpp"
+#include "vcf_sort.hpp"
+#include "workers.hpp"
+
+// FORMAT fields declared in the output header
+inline constexpr std::pair<char const *, char const *> formatHeaderRecords[] = {
+  {"FORMAT", "<ID=GT,Number=1,Type=String,Description=\"Genotype\">"},
+  {"FORMAT",
+   "<ID=AD,Number=3,Type=Integer,Description=\"Allelic depths from alignment supporting ref and alt allele and total "
+   "number of reads\">"},
+  {"FORMAT",
+   "<ID=VA,Number=3,Type=Integer,Description=\"Allelic depths from bam file supporting ref and alt allele and total "
+   "number of reads\">"},
+  {"FORMAT", "<ID=PL,Number=G,Type=Integer,Description=\"PHRED-scaled genotype likelihoods\">"},
+  {"FORMAT", "<ID=REFREADS,Number=1,Type=String,Description=\"Reads support ref\">"},
+  {"FORMAT", "<ID=ALTREADS,Number=1,Type=String,Description=\"Reads support alt\">"}};
+
+// FORMAT keys appended to every record; the values are computed by genotypeVariant()
+inline constexpr char formatKeys[] = ":REFREADS:ALTREADS";
+
+// Appends the FORMAT keys and the computed values of the first sample to the record
+inline void appendSampleValues(seqan::VcfRecord & var, std::string const & values)
+{
+    if (empty(var.genotypeInfos)) // no sample column in the input
+    {
+        var.format = formatKeys + 1;
+        appendValue(var.genotypeInfos, seqan::CharString{values.c_str() + 1});
+    }
+    else
+    {
+        var.format += formatKeys;
+        var.genotypeInfos[0] += values;
+    }
+}
+
+inline constexpr char degradedHeaderRecord[] =
+  "<ID=DEGRADED,Number=1,Type=String,Description=\"Alignment effort was reduced to stay within "
+  "--max-cells-per-variant: reads (fewer reads aligned), band (narrower band) or cigar (no alignment)\">";
+
+// INFO entry of records whose alignment effort was reduced, or an empty string
+inline std::string degradedInfoEntry(budget_level const level)
+{
+    return level == budget_level::full ? std::string{} : std::string{"DEGRADED="} + budgetLevelName(level);
+}
+
+// Appends the INFO entry of a record whose alignment effort was reduced
+inline void appendDegradedInfo(seqan::VcfRecord & var, budget_level const level)
+{
+    if (level == budget_level::full)
+        return;
+
+    if (empty(var.info) || var.info == ".")
+        clear(var.info);
+    else
+        appendValue(var.info, ';');
+    append(var.info, degradedInfoEntry(level).c_str());
+}
+
+// Sample values and budget levels of a chunk as returned by a worker process (with --passthrough)
+inline std::string encodeSampleValues(std::span<std::string const> values, std::span<budget_level const> levels)
+{
+    std::string bytes;
+    for (size_t j = 0; j < values.size(); ++j)
+    {
+        bytes += static_cast<char>(levels[j]);
+        bytes += values[j];
+        bytes += '\n';
+    }
+    return bytes;
+}
+
+// Returns false if bytes do not hold exactly the values of the chunk
+inline bool decodeSampleValues(std::string_view bytes, std::span<std::string> values, std::span<budget_level> levels)
+{
+    for (size_t j = 0; j < values.size(); ++j)
+    {
+        size_t const end = bytes.find('\n');
+        if (end == std::string_view::npos || end == 0)
+            return false;
+        levels[j] = static_cast<budget_level>(bytes[0]);
+        values[j] = bytes.substr(1, end - 1);
+        bytes.remove_prefix(end + 1);
+    }
+    return bytes.empty();
+}
+
+// Upper estimate of the size of the formatted records, so that the output buffer is allocated only once
+inline size_t formattedSizeEstimate(std::span<seqan::VcfRecord const> records,
+                                    std::span<std::string const>      sampleValues)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        seqan::VcfRecord const & var = records[i];
+        size += 64 + length(var.id) + length(var.ref) + length(var.alt) + length(var.filter) + length(var.info) +
+                length(var.format) + sizeof(formatKeys) + sampleValues[i].size();
+        for (size_t j = 0; j < length(var.genotypeInfos); ++j)
+            size += 1 + length(var.genotypeInfos[j]);
+    }
+    return size;
+}
 
 void mainProgram(LRCOptions & O)
 {
     // THIS NEEDS TO BE SET BEFORE ANY BAM OBJECTS ARE DECLARED; parallelism happens on higher level, so this is 1
     lrcaller_bgzf_threads = 1;
 
+    // every worker process and MPI rank is single-threaded
+    if (O.workers > 1 || O.ranks > 1)
+        O.nThreads = 1;
+
     if (O.verbose)
         std::cerr << "Number of threads requested: " << O.nThreads << ". Got: " << omp_get_max_threads() << ".\n";
 
-    seqan::VcfFileIn              vcfIn(O.vcfInFile.c_str());
-    seqan::VcfHeader              header;
-    std::vector<seqan::VcfRecord> vcfRecords;
+    if (O.passthrough && (O.vcfInFile == "-" || !O.vcfInFile.ends_with(".vcf")))
+    {
+        std::cerr << "WARNING: --passthrough requires an uncompressed VCF file as input; records are re-serialised "
+                     "instead.\n";
+        O.passthrough = false;
+    }
 
+    // "-" reads from stdin and writes to stdout, so that lrcaller can be used in a pipe
+    seqan::VcfFileIn vcfIn;
+    if (O.vcfInFile == "-")
+    {
+        if (!open(vcfIn, std::cin, seqan::Vcf()))
+            throw error{"Could not read VCF from stdin."};
+    }
+    else if (!open(vcfIn, O.vcfInFile.c_str()))
+    {
+        throw error{"Could not open ", O.vcfInFile, " for reading."};
+    }
+
+    seqan::VcfHeader header;
     readHeader(header, vcfIn);
-    while (!atEnd(vcfIn))
+
+    // Open the input VCF file and prepare output VCF stream.
+    std::vector<std::string> formatMetaLines;
+    for (auto const & [key, value] : formatHeaderRecords)
     {
-        seqan::VcfRecord r;
-        readRecord(r, vcfIn);
+        appendValue(header, seqan::VcfHeaderRecord(key, value));
+        formatMetaLines.push_back(std::string{"##"} + key + "=" + value);
+    }
+    if (O.maxCellsPerVariant > 0)
+    {
+        appendValue(header, seqan::VcfHeaderRecord("INFO", degradedHeaderRecord));
+        formatMetaLines.push_back(std::string{"##INFO="} + degradedHeaderRecord);
+    }
 
-        vcfRecords.push_back(std::move(r));
+    std::ofstream  vcfFileStream;
+    std::ostream & vcfStream = O.vcfOutFile == "-" ? std::cout : vcfFileStream;
+    if (O.vcfOutFile != "-")
+    {
+        vcfFileStream.open(O.vcfOutFile);
+        if (!vcfFileStream)
+            throw error{"Could not open ", O.vcfOutFile, " for writing."};
     }
 
-    // Open the input VCF file and prepare output VCF stream.
-    appendValue(header, seqan::VcfHeaderRecord("FORMAT", "<ID=GT,Number=1,Type=String,Description=\"Genotype\">"));
-    appendValue(header,
-                seqan::VcfHeaderRecord("FORMAT",
-                                       "<ID=AD,Number=3,Type=Integer,Description=\"Allelic depths from alignment "
-                                       "supporting ref and alt allele and total number of reads\">"));
-    appendValue(header,
-                seqan::VcfHeaderRecord("FORMAT",
-                                       "<ID=VA,Number=3,Type=Integer,Description=\"Allelic depths from bam file "
-                                       "supporting ref and alt allele and total number of reads\">"));
-    appendValue(
-      header,
-      seqan::VcfHeaderRecord("FORMAT",
-                             "<ID=PL,Number=G,Type=Integer,Description=\"PHRED-scaled genotype likelihoods\">"));
-    appendValue(
-      header,
-      seqan::VcfHeaderRecord("FORMAT",
-                             "<ID=REFREADS,Number=1,Type=String,Description=\"Reads support ref\">"));
-    appendValue(
-      header,
-      seqan::VcfHeaderRecord("FORMAT",
-                             "<ID=ALTREADS,Number=1,Type=String,Description=\"Reads support alt\">"));
-    std::ofstream     vcfStream(O.vcfOutFile.c_str());
-    seqan::VcfFileOut vcfOut(vcfIn);
-    open(vcfOut, vcfStream, seqan::Vcf());
-    writeHeader(vcfOut, header);
+    std::ifstream rawIn;
+    if (O.passthrough)
+    {
+        rawIn.open(O.vcfInFile);
+        if (!rawIn)
+            throw error{"Could not open ", O.vcfInFile, " for reading."};
+        copyPassthroughHeader(rawIn, vcfStream, formatMetaLines);
+    }
+    else
+    {
+        seqan::CharString buffer;
+        writeHeader(buffer, header, seqan::context(vcfIn), seqan::Vcf());
+        vcfStream.write(begin(buffer, seqan::Standard()), length(buffer));
+    }
+    vcfStream.flush();
 
     //     bool useBam2 = false;
     //     if (O.bam2 != "")
@@ -84,74 +222,426 @@ void mainProgram(LRCOptions & O)
 
     omp_set_num_threads(O.nThreads);
 
+    if (O.pinThreads && !pinThreads(O.nThreads))
+        std::cerr << "WARNING: Could not pin the threads to CPUs; continuing without.\n";
+
     struct thread_cache_t
     {
         std::vector<seqan::BamAlignmentRecord> bars;
         seqan::CharString                      chrom;
 
-        std::vector<seqan::BamFileIn>            bamFiles;
-        std::vector<seqan::BamIndex<seqan::Bai>> bamIndexes;
+        std::vector<seqan::BamFileIn> bamFiles;
 
         seqan::FaiIndex faIndex;
+
+        score_cache scoreCache;
+
+        // records are formatted by the workers; the context only provides the contig names
+        std::remove_cvref_t<decltype(seqan::context(vcfIn))> vcfContext;
     };
 
+    auto const startupBegin = std::chrono::steady_clock::now();
+
+    std::vector<std::filesystem::path> const bamPaths = parseBamFileName(O.bam, O);
+    size_t const                             nBams    = bamPaths.size();
+
+    // BAM indexes are shared by all threads; their contigs are mapped from the index cache or parsed when first used
+    std::vector<bai_index> bamIndexes(nBams);
+
+    bam_prefetcher prefetcher;
+    if (O.prefetch)
+        prefetcher.open(bamPaths);
+
+    result_cache resultCache;
+    if (!O.resultCacheDir.empty())
+        resultCache.open(O.resultCacheDir, resultRunHash(O, bamPaths));
+
+    // evidence of earlier runs is added to, and/or the accumulated evidence is saved (see evidence.hpp)
+    bool const     useEvidence = !O.loadEvidenceFile.empty() || !O.saveEvidenceFile.empty();
+    evidence_store previousEvidence;
+    if (!O.loadEvidenceFile.empty())
+        previousEvidence.load(O.loadEvidenceFile, genotypingModelCount(O.gtModel));
+
+    std::ofstream evidenceOut;
+    if (!O.saveEvidenceFile.empty())
+    {
+        evidenceOut.open(O.saveEvidenceFile);
+        if (!evidenceOut)
+            throw error{"Could not open ", O.saveEvidenceFile, " for writing."};
+        evidenceOut << EVIDENCE_FILE_HEADER << '\n';
+    }
+
     std::vector<thread_cache_t> per_thread;
     per_thread.resize(O.nThreads);
 
-    for (thread_cache_t & c : per_thread)
+    // every thread allocates its own caches, so that they are local to its NUMA node (first touch)
+#pragma omp parallel
+    {
+        thread_cache_t & c = per_thread[omp_get_thread_num()];
+        c.bamFiles.resize(nBams);
+        c.scoreCache = score_cache{O.scoreCacheSize, alignment_scheme{O.match, O.mismatch, O.gapOpen, O.gapExtend}};
+        c.vcfContext = seqan::context(vcfIn);
+    }
+
+    // Files are opened in parallel, because latency dominates on network file systems; pinned threads open their own
+    omp_set_schedule(O.pinThreads ? omp_sched_static : omp_sched_dynamic, O.pinThreads ? nBams + 1 : 1);
+    std::exception_ptr openError;
+#pragma omp parallel for schedule(runtime)
+    for (size_t task = 0; task < O.nThreads * (nBams + 1); ++task)
     {
-        parseBamFileName(O.bam, c.bamFiles, c.bamIndexes, O);
+        size_t const     thread = task / (nBams + 1);
+        size_t const     file   = task % (nBams + 1);
+        thread_cache_t & c      = per_thread[thread];
 
-        if (!open(c.faIndex, O.faFile.c_str()))
-            if (!build(c.faIndex, O.faFile.c_str()))
+        try
+        {
+            if (file < nBams)
+            {
+                initializeBam(bamPaths[file], c.bamFiles[file]);
+                if (thread == 0)
+                    openBamIndex(bamIndexes[file], bamPaths[file], O);
+            }
+            else if (!open(c.faIndex, O.faFile.c_str()) && !build(c.faIndex, O.faFile.c_str()))
+            {
                 throw error{"Could neither find nor build the index of ", O.faFile};
+            }
+        }
+        catch (...)
+        {
+#pragma omp critical
+            if (!openError)
+                openError = std::current_exception();
+        }
     }
+    if (openError)
+        std::rethrow_exception(openError);
+
+    if (O.verbose)
+        std::cerr << "Opened " << nBams << " BAM file(s) for " << O.nThreads << " thread(s) in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - startupBegin).count() << "s.\n";
+
+    // IDs of the VCF contigs in reference and BAM files; contigs missing from the header are added while reading
+    contig_table contigs{per_thread[0].bamFiles.size()};
+    contigs.update(seqan::contigNames(seqan::context(vcfIn)), per_thread[0].faIndex, per_thread[0].bamFiles);
 
     //     if (useBam2)
     //         parseBamFileName(seqan::toCString(O.bam2), bamIndex2Handles, bam2Handles, O);
 
-    // split input into chunks of adjacent variants so that reads are only read once
-    std::vector<std::span<seqan::VcfRecord>> chunks;
-    size_t                                   chunk_first = 0;
-    for (size_t i = 1; i < length(vcfRecords); ++i)
+    /* Records are read and genotyped in batches of complete chunks, and every batch is written before the next one
+     * is read. This keeps memory bounded and output flowing when reading from a pipe. The last chunk of a batch may
+     * continue in the next record, so it is carried over to the next batch.
+     */
+    size_t const parallelism  = std::max({O.nThreads, O.workers, size_t(O.ranks - 1)}); // rank 0 only coordinates
+    size_t const batchChunks  = 16 * parallelism;
+    size_t const batchRecords = 1024 * parallelism;
+
+    // specialised for the options that are tested per read (see chunk_mode)
+    process_chunk_t * const processChunkOfRun = chunkProcessor(O);
+
+    std::vector<seqan::VcfRecord> batch;
+    std::vector<std::string>      sampleValues; // the values computed for the first sample of each record
+    std::vector<budget_level>     budgetLevels; // whether the alignment effort of each record was reduced
+    std::vector<variant_evidence> evidence;     // with useEvidence: the accumulated evidence of each record
+    size_t                        nComplete = 0; // complete chunks in batch
+    size_t                        nRead     = 0;
+
+    // unsorted input is genotyped correctly, but every out-of-order record starts a new chunk
+    std::vector<bool> contigSeen;
+    bool              warnedUnsorted = false;
+    int32_t           lastRID        = -1;
+    int32_t           lastPos        = 0;
+
+    for (bool eof = false; !eof;)
     {
-        seqan::VcfRecord & var = vcfRecords[i];
-        if (var.rID == -1)
-            throw error{"Invalid ID in VCF record number: ", i};
+        eof = atEnd(vcfIn);
+        if (!eof)
+        {
+            alloc_stage_scope stage{alloc_stage::input};
+            seqan::VcfRecord  r;
+            readRecord(r, vcfIn);
+            if (r.rID == -1)
+                throw error{"Invalid ID in VCF record number: ", nRead};
+
+            if (!warnedUnsorted && (r.rID == lastRID ? r.beginPos < lastPos
+                                                     : r.rID < (int32_t)contigSeen.size() && contigSeen[r.rID]))
+            {
+                std::cerr << "WARNING: The input VCF is not sorted by coordinate (record number " << nRead
+                          << "). This makes genotyping much slower; consider --sort-input.\n";
+                warnedUnsorted = true;
+            }
+            if (r.rID >= (int32_t)contigSeen.size())
+                contigSeen.resize(r.rID + 1, false);
+            if (!contigSeen[r.rID])
+            {
+                contigs.update(seqan::contigNames(seqan::context(vcfIn)),
+                               per_thread[0].faIndex,
+                               per_thread[0].bamFiles);
+                contigs.reportIfMissing(r.rID);
+            }
+            contigSeen[r.rID] = true;
+            lastRID           = r.rID;
+            lastPos           = r.beginPos;
+            ++nRead;
+
+            if (!batch.empty() && startsNewChunk(batch.back(), r, O))
+                ++nComplete;
+            batch.push_back(std::move(r));
+
+            if (nComplete < batchChunks && (nComplete == 0 || batch.size() < batchRecords))
+                continue;
+        }
+
+        // split batch into chunks of adjacent variants so that reads are only read once
+        std::vector<std::span<seqan::VcfRecord>> chunks = splitIntoChunks(std::span{batch}, O);
+        if (!eof)
+            chunks.pop_back();
+
+        std::vector<size_t> chunkOffsets(chunks.size() + 1); // index of the first record of every chunk
+        for (size_t i = 0; i < chunks.size(); ++i)
+            chunkOffsets[i + 1] = chunkOffsets[i] + chunks[i].size();
+
+        size_t const nRecords = chunkOffsets.back();
+        sampleValues.clear();
+        sampleValues.resize(nRecords);
+        budgetLevels.assign(nRecords, budget_level::full);
+        evidence.clear();
+        evidence.resize(useEvidence ? nRecords : 0);
+
+        // contigs that are not declared in the header are added while reading
+        for (thread_cache_t & c : per_thread)
+            if (length(seqan::contigNames(c.vcfContext)) != length(seqan::contigNames(seqan::context(vcfIn))))
+                c.vcfContext = seqan::context(vcfIn);
+
+        // formatted output of every chunk (without --passthrough)
+        std::vector<seqan::CharString> chunkOutput(chunks.size());
+        std::vector<std::string>       chunkEvidence(chunks.size()); // lines of the evidence file
+        std::vector<std::string>       chunkLog(chunks.size());      // messages of LRC_DEBUG() and LRC_TRACE()
+
+        auto valuesOf = [&](size_t const i)
+        { return std::span{sampleValues}.subspan(chunkOffsets[i], chunks[i].size()); };
+        auto levelsOf = [&](size_t const i)
+        { return std::span{budgetLevels}.subspan(chunkOffsets[i], chunks[i].size()); };
+
+        // formats the records of a chunk with their computed values
+        auto formatChunk = [&](size_t const i, thread_cache_t & thread_cache)
+        {
+            alloc_stage_scope           stage{alloc_stage::output};
+            std::span<seqan::VcfRecord> chunk  = chunks[i];
+            std::span<std::string>      values = valuesOf(i);
+            std::span<budget_level>     levels = levelsOf(i);
+            for (size_t j = 0; j < chunk.size(); ++j)
+                appendDegradedInfo(chunk[j], levels[j]);
+
+            seqan::CharString & buffer = chunkOutput[i];
+            reserve(buffer, formattedSizeEstimate(chunk, values));
+            for (size_t j = 0; j < chunk.size(); ++j)
+            {
+                appendSampleValues(chunk[j], values[j]);
+                writeRecord(buffer, chunk[j], thread_cache.vcfContext, seqan::Vcf());
+                std::string{}.swap(values[j]); // release the read names early
+            }
+        };
+
+        // genotypes the chunk and formats its records (without --passthrough)
+        auto genotypeChunk = [&](size_t const i, thread_cache_t & thread_cache)
+        {
+            std::span<seqan::VcfRecord> chunk  = chunks[i];
+            std::span<std::string>      values = valuesOf(i);
+            std::span<budget_level>     levels = levelsOf(i);
+            std::span<variant_evidence> chunkEv;
 
-        if (seqan::VcfRecord & lastVar = vcfRecords[i - 1];
-            (var.rID != lastVar.rID) || (var.beginPos > lastVar.beginPos + (ssize_t)O.wSize)) // new chunk
+            thread_cache.bars.clear();
+            thread_cache.chrom = seqan::contigNames(seqan::context(vcfIn))[chunk.begin()->rID];
+
+            if (useEvidence)
+            {
+                chunkEv = std::span{evidence}.subspan(chunkOffsets[i], chunk.size());
+                for (size_t j = 0; j < chunk.size() && !previousEvidence.empty(); ++j)
+                {
+                    std::string const key = evidenceKey(thread_cache.chrom, chunk[j]);
+                    if (variant_evidence const * previous = previousEvidence.find(key))
+                        chunkEv[j] = *previous;
+                }
+            }
+
+            // chunks whose records, reference and reads are unchanged are taken from the result cache
+            uint64_t cacheKey = 0;
+            bool     cached   = false;
+            if (resultCache.enabled())
+            {
+                cacheKey = resultCache.chunkKey(chunk,
+                                                thread_cache.chrom,
+                                                thread_cache.faIndex,
+                                                contigs.faiId(chunk.front().rID),
+                                                O);
+                if (std::optional<std::string> const bytes = resultCache.load(cacheKey))
+                    cached = decodeSampleValues(*bytes, values, levels);
+            }
+
+            if (!cached)
+            {
+                processChunkOfRun(thread_cache.bamFiles,
+                                  bamIndexes,
+                                  prefetcher,
+                                  thread_cache.faIndex,
+                                  thread_cache.chrom,
+                                  contigs,
+                                  thread_cache.bars,
+                                  chunk,
+                                  values,
+                                  levels,
+                                  chunkEv,
+                                  thread_cache.scoreCache,
+                                  O);
+
+                if (resultCache.enabled())
+                    resultCache.store(cacheKey, encodeSampleValues(values, levels));
+            }
+
+            if (evidenceOut.is_open())
+                for (size_t j = 0; j < chunk.size(); ++j)
+                    if (!chunkEv[j].empty())
+                        writeEvidence(chunkEvidence[i], evidenceKey(thread_cache.chrom, chunk[j]), chunkEv[j]);
+
+            if (!O.passthrough)
+                formatChunk(i, thread_cache);
+
+            chunkLog[i] = takeLog();
+        };
+
+        // result of a chunk as returned by a worker process or MPI rank
+        auto chunkResult = [&](size_t const i)
         {
-            chunks.emplace_back(vcfRecords.begin() + chunk_first, vcfRecords.begin() + i);
-            chunk_first = i;
+            genotypeChunk(i, per_thread[0]);
+            std::cerr << chunkLog[i]; // only the results are returned in order
+            return O.passthrough ? encodeSampleValues(valuesOf(i), levelsOf(i))
+                                 : std::string{begin(chunkOutput[i], seqan::Standard()), length(chunkOutput[i])};
+        };
+        // returns false if the result does not hold exactly the records of the chunk (e.g. it was truncated)
+        auto receiveResult = [&](size_t const i, std::string_view const result)
+        {
+            if (O.passthrough)
+                return decodeSampleValues(result, valuesOf(i), levelsOf(i));
+
+            if (std::ranges::count(result, '\n') != (ptrdiff_t)chunks[i].size())
+                return false;
+            chunkOutput[i] = std::string{result};
+            return true;
+        };
+
+        if (O.ranks > 1)
+        {
+            runInRanks(chunks.size(),
+                       chunkResult,
+                       [&](size_t const i, std::string_view const result)
+                       {
+                           if (!receiveResult(i, result))
+                               throw error{"Received an invalid result for chunk ", i, " of the batch."};
+                       });
         }
-    }
-    // last chunk
-    chunks.emplace_back(vcfRecords.begin() + chunk_first, vcfRecords.begin() + vcfRecords.size());
+        else if (O.workers > 1)
+        {
+            // contigs are parsed here once and shared with the workers, instead of in every worker
+            for (std::span<seqan::VcfRecord> const chunk : chunks)
+                for (size_t b = 0; b < nBams; ++b)
+                    if (uint32_t const bamRID = contigs.bamId(chunk.front().rID, b); bamRID != NO_CONTIG)
+                        bamIndexes[b].contig(bamRID);
+
+            runInWorkers(
+              chunks.size(),
+              O.workers,
+              [&]
+              {
+                  // the file offsets would otherwise be shared with the main process and the other workers
+                  thread_cache_t & c = per_thread[0];
+                  for (size_t b = 0; b < nBams; ++b)
+                  {
+                      close(c.bamFiles[b]);
+                      initializeBam(bamPaths[b], c.bamFiles[b]);
+                  }
+                  if (!open(c.faIndex, O.faFile.c_str()))
+                      throw error{"Could not open the index of ", O.faFile};
+              },
+              chunkResult,
+              receiveResult,
+              [&](size_t const i)
+              {
+                  // the chunk crashed or failed in every attempt; its records are written without genotypes
+                  std::span<seqan::VcfRecord> const chunk = chunks[i];
+                  std::cerr << "WARNING: The chunk at " << seqan::contigNames(seqan::context(vcfIn))[chunk.front().rID]
+                            << ':' << chunk.front().beginPos + 1 << " failed in " << WORKER_ATTEMPTS
+                            << " workers; its " << chunk.size() << " record(s) are written without genotypes.\n";
 
+                  std::ranges::fill(valuesOf(i), std::string{NO_READS_SAMPLE_VALUES});
+                  std::ranges::fill(levelsOf(i), budget_level::full);
+                  if (!O.passthrough)
+                      formatChunk(i, per_thread[0]);
+              });
+        }
+        else
+        {
 #pragma omp parallel for
-    for (size_t i = 0; i < chunks.size(); ++i)
-    {
-        std::span<seqan::VcfRecord> chunk        = chunks[i];
-        thread_cache_t &            thread_cache = per_thread[omp_get_thread_num()];
+            for (size_t i = 0; i < chunks.size(); ++i)
+                genotypeChunk(i, per_thread[omp_get_thread_num()]);
 
-        thread_cache.bars.clear();
-        thread_cache.chrom = seqan::contigNames(seqan::context(vcfIn))[chunk.begin()->rID];
+            for (std::string const & messages : chunkLog)
+                std::cerr << messages;
+        }
 
-        processChunk(thread_cache.bamFiles,
-                     thread_cache.bamIndexes,
-                     thread_cache.faIndex,
-                     thread_cache.chrom,
-                     thread_cache.bars,
-                     chunk,
-                     O);
+        // the other ranks of lrcaller_mpi only hold the results of the chunks they processed themselves
+        if (O.rank == 0)
+        {
+            alloc_stage_scope stage{alloc_stage::output};
+            if (O.passthrough)
+            {
+                std::string line;
+                for (size_t i = 0; i < nRecords; ++i)
+                {
+                    nextPassthroughRecord(rawIn, line);
+                    writePassthroughRecord(vcfStream,
+                                           line,
+                                           formatKeys,
+                                           sampleValues[i],
+                                           degradedInfoEntry(budgetLevels[i]));
+                }
+            }
+            else
+            {
+                for (seqan::CharString const & buffer : chunkOutput)
+                    vcfStream.write(begin(buffer, seqan::Standard()), length(buffer));
+            }
+            vcfStream.flush();
+
+            for (std::string const & lines : chunkEvidence)
+                evidenceOut << lines;
+        }
+
+        batch.erase(batch.begin(), batch.begin() + nRecords);
+        nComplete = 0;
     }
 
-    for (seqan::VcfRecord /*const ? */ & var : vcfRecords)
+    if (!vcfStream)
+        throw error{"Could not write the output VCF."};
+    if (evidenceOut.is_open() && !evidenceOut.flush())
+        throw error{"Could not write the evidence file ", O.saveEvidenceFile, "."};
+
+    if (O.verbose && O.scoreCacheSize > 0)
     {
-        writeRecord(vcfOut, var);
+        score_cache_stats stats;
+        for (thread_cache_t const & c : per_thread)
+            stats += c.scoreCache.stats;
+
+        size_t const lookups = stats.hits + stats.misses;
+        std::cerr << "Alignment score cache: " << stats.hits << " reads found, " << stats.misses << " aligned ("
+                  << (lookups > 0 ? 100.0 * stats.hits / lookups : 0.0) << "% hit rate).\n";
     }
 
+    if (O.verbose && resultCache.enabled())
+        std::cerr << "Result cache: " << resultCache.hits << " chunks reused, " << resultCache.misses
+                  << " computed.\n";
+
+    printAllocStats(std::cerr); // only in builds with LRCALLER_ALLOC_STATS
+
     if (O.cacheDataInTmp)
     {
         if (O.verbose)
@@ -164,16 +654,108 @@ void mainProgram(LRCOptions & O)
     }
 }
 
+/* Genotypes the input sorted by coordinate; with --keep-input-order, the output is sorted back into input order.
+ * Every rank of lrcaller_mpi sorts its own copy of the input (temporary directories may be local to a node), but only
+ * rank 0 writes and restores the output.
+ */
+void sortedMainProgram(LRCOptions & O)
+{
+    std::filesystem::path tmpDir = std::filesystem::temp_directory_path() / "tmp-lrcaller-sort-XXXXXX";
+    std::string           buffer = tmpDir.string();
+    if (mkdtemp(buffer.data()) == nullptr)
+        throw error{"Could not create temporary directory for sorting."};
+    tmpDir = buffer;
+
+    size_t const                maxMemory = O.sortMemory << 20;
+    std::filesystem::path const sortedIn  = tmpDir / "sorted.vcf";
+    std::filesystem::path const sortedOut = tmpDir / "genotyped.vcf";
+    std::filesystem::path const indexFile = tmpDir / "sorted.idx";
+    LRCOptions                  sortedO   = O;
+    bool const                  restore   = O.keepInputOrder && O.rank == 0;
+
+    try
+    {
+        if (O.verbose)
+            std::cerr << "Sorting input VCF in " << tmpDir << '\n';
+        sortVcf(O.vcfInFile, sortedIn, indexFile, tmpDir, maxMemory);
+
+        sortedO.vcfInFile = sortedIn.string();
+        if (restore)
+            sortedO.vcfOutFile = sortedOut.string();
+
+        mainProgram(sortedO);
+
+        if (restore)
+        {
+            if (O.verbose)
+                std::cerr << "Restoring input order...\n";
+
+            std::ofstream  outFile;
+            std::ostream & out = O.vcfOutFile == "-" ? std::cout : outFile;
+            if (O.vcfOutFile != "-")
+                outFile.open(O.vcfOutFile);
+
+            restoreInputOrder(sortedOut, indexFile, out, tmpDir, maxMemory);
+            if (!out.flush())
+                throw error{"Could not write the output VCF."};
+        }
+    }
+    catch (...)
+    {
+        std::filesystem::remove_all(tmpDir);
+        throw;
+    }
+
+    std::filesystem::remove_all(tmpDir);
+}
+
 int main(int argc, char const ** argv)
 {
-    LRCOptions O;
+    mpi_session mpi{argc, argv};
+    LRCOptions  O;
 
     try
     {
+        // "lrcaller plan ..." takes the same arguments, but only estimates the cost of the run
+        bool const plan = argc > 1 && std::string_view{argv[1]} == "plan";
+        if (plan)
+        {
+            --argc;
+            ++argv;
+        }
+
         auto res = parseLRCArguments(argc, argv, O);
 
+        // only rank 0 writes; the other ranks (of lrcaller_mpi) genotype the chunks it hands out
+        O.rank  = mpi.rank;
+        O.ranks = mpi.ranks;
+        if (mpi.rank != 0)
+        {
+            O.vcfOutFile = "/dev/null";
+            O.verbose    = false;
+            O.trace      = false;
+        }
+        setLogLevel(O.trace ? log_level::trace : O.verbose ? log_level::debug : log_level::off);
+
         if (res == seqan::ArgumentParser::PARSE_ERROR)
             throw error{"Could not parse command line arguments."};
+        else if (res == seqan::ArgumentParser::PARSE_OK && O.keepInputOrder && !O.sortInput)
+            throw error{"--keep-input-order requires --sort-input."};
+        else if (res == seqan::ArgumentParser::PARSE_OK && O.tileIndex && O.indexCacheDir.empty())
+            throw error{"--tile-index requires --index-cache-dir."};
+        else if (res == seqan::ArgumentParser::PARSE_OK && O.workers > 1 && O.pinThreads)
+            throw error{"--pin-threads cannot be combined with --workers."};
+        else if (res == seqan::ArgumentParser::PARSE_OK && O.ranks > 1 && (O.workers > 1 || O.vcfInFile == "-"))
+            throw error{"With MPI, --workers cannot be used and the VCF cannot be read from stdin."};
+        else if (res == seqan::ArgumentParser::PARSE_OK &&
+                 (!O.saveEvidenceFile.empty() || !O.loadEvidenceFile.empty()) &&
+                 (O.workers > 1 || O.ranks > 1 || !O.resultCacheDir.empty()))
+            throw error{"--save-evidence and --load-evidence cannot be combined with --workers, MPI or "
+                        "--result-cache."};
+        else if (res == seqan::ArgumentParser::PARSE_OK && plan)
+            planProgram(O);
+        else if (res == seqan::ArgumentParser::PARSE_OK && O.sortInput)
+            sortedMainProgram(O);
         else if (res == seqan::ArgumentParser::PARSE_OK)
             mainProgram(O);
         // else the help page was shown
@@ -181,6 +763,13 @@ int main(int argc, char const ** argv)
     catch (error const & e)
     {
         std::cerr << "ERROR: " << e.what() << '\n';
+        mpi.abort(1);
+        return 1;
+    }
+    catch (std::exception const & e) // e.g. std::bad_alloc or std::filesystem::filesystem_error
+    {
+        std::cerr << "ERROR: " << e.what() << '\n';
+        mpi.abort(1);
         return 1;
     }
 
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef LRCALLER_MPI
+#    include <mpi.h>
+#endif
+
+/* Multi-node execution (lrcaller_mpi, built with -DLRCALLER_MPI=ON)
+ *
+ * All ranks read the VCF file and form the same batches and chunks; reading is cheap compared with genotyping. Rank 0
+ * only coordinates: the other ranks ask it for the next chunk of the batch whenever they are idle (self-scheduling),
+ * send back the result with the next request, and rank 0 writes all results in order. Every rank is single-threaded,
+ * so one rank should be started per core, e.g. `mpirun -np 4 lrcaller_mpi ...` on one machine.
+ * In the normal build, there is a single rank that does all the work.
+ */
+
+class mpi_session
+{
+public:
+    mpi_session([[maybe_unused]] int & argc, [[maybe_unused]] char const **& argv)
+    {
+#ifdef LRCALLER_MPI
+        MPI_Init(&argc, const_cast<char ***>(&argv));
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+#endif
+    }
+    mpi_session(mpi_session const &) = delete;
+    mpi_session & operator=(mpi_session const &) = delete;
+
+    ~mpi_session()
+    {
+#ifdef LRCALLER_MPI
+        MPI_Finalize();
+#endif
+    }
+
+    // Terminates all ranks, which would otherwise wait for the one that failed
+    void abort([[maybe_unused]] int const status) const
+    {
+#ifdef LRCALLER_MPI
+        if (ranks > 1)
+            MPI_Abort(MPI_COMM_WORLD, status);
+#endif
+    }
+
+    int rank  = 0;
+    int ranks = 1;
+};
+
+/* Processes tasks [0, nTasks) on all ranks but 0.
+ *  - work(i) runs on some rank and returns the result of task i as bytes;
+ *  - receive(i, bytes) runs on rank 0, in order of i.
+ * Must be called by all ranks with the same number of tasks.
+ */
+template <typename work_t, typename receive_t>
+void runInRanks(size_t const nTasks, work_t && work, receive_t && receive)
+{
+#ifdef LRCALLER_MPI
+    constexpr int      TAG     = 1;
+    constexpr uint64_t NO_TASK = UINT64_MAX;
+
+    int rank  = 0;
+    int ranks = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    if (ranks > 1 && rank == 0)
+    {
+        // every message is the index of the finished task (or NO_TASK) followed by its result
+        std::vector<std::string> results(nTasks);
+        std::vector<char>        message;
+        uint64_t                 next    = 0;
+        int                      running = ranks - 1;
+        while (running > 0)
+        {
+            MPI_Status status;
+            int        count = 0;
+            MPI_Probe(MPI_ANY_SOURCE, TAG, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_BYTE, &count);
+            message.resize(count);
+            MPI_Recv(message.data(), count, MPI_BYTE, status.MPI_SOURCE, TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+            uint64_t done = NO_TASK;
+            std::memcpy(&done, message.data(), sizeof(done));
+            if (done != NO_TASK)
+                results[done].assign(message.data() + sizeof(done), count - sizeof(done));
+
+            uint64_t const task = next < nTasks ? next++ : NO_TASK;
+            running -= task == NO_TASK;
+            MPI_Send(&task, 1, MPI_UINT64_T, status.MPI_SOURCE, TAG, MPI_COMM_WORLD);
+        }
+
+        for (size_t i = 0; i < nTasks; ++i)
+            receive(i, std::string_view{results[i]});
+        return;
+    }
+
+    if (ranks > 1)
+    {
+        std::string message(sizeof(NO_TASK), '\0');
+        std::memcpy(message.data(), &NO_TASK, sizeof(NO_TASK));
+        for (;;)
+        {
+            uint64_t task = NO_TASK;
+            MPI_Send(message.data(), message.size(), MPI_BYTE, 0, TAG, MPI_COMM_WORLD);
+            MPI_Recv(&task, 1, MPI_UINT64_T, 0, TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            if (task == NO_TASK)
+                return;
+
+            std::string const result = work(task);
+            message.resize(sizeof(task));
+            std::memcpy(message.data(), &task, sizeof(task));
+            message += result;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < nTasks; ++i)
+        receive(i, std::string_view{work(i)});
+}
@@ -29,6 +29,7 @@ struct LRCOptions
     size_t wSize                   = 500; // Window Size,
     size_t maxBARcount             = 200; // maximum number of reads to use for a variant
     bool   verbose                 = false;
+    bool   trace                   = false; // with LRCALLER_ENABLE_TRACE: also trace every CIGAR operation
     bool   genotypeRightBreakpoint = false;
     double logScaleFactor          = 2.0;
     size_t bandedAlignmentPercent  = 40;
@@ -57,11 +58,37 @@ struct LRCOptions
     // Fraction of deletion/insertion length can be at most be observed to be deleted/inserted to call alt
     double altThreshFractionMax = 100.0;
 
-    genotyping_model gtModel  = genotyping_model::multi;
-    size_t           nThreads = std::thread::hardware_concurrency();
+    genotyping_model gtModel    = genotyping_model::multi;
+    size_t           nThreads   = std::thread::hardware_concurrency();
+    bool             pinThreads = false; // bind every thread to one CPU (NUMA locality)
+    size_t           workers    = 0;     // process chunks in this many forked processes instead of threads
+    int              rank       = 0;     // MPI rank of this process and number of ranks (set by lrcaller_mpi)
+    int              ranks      = 1;
 
     bool                  cacheDataInTmp = false; // whether to copy BAM and BAI to /tmp at start
     std::filesystem::path cacheDir;               // where to store cache
+    std::string           indexCacheDir;          // where parsed BAM indexes are kept between runs (empty == off)
+    bool                  tileIndex = false;      // store an index of the reads reaching into every 16 kb tile
+    bool                  prefetch  = false;      // announce the BAM blocks of a chunk to the kernel before reading
+    std::string           resultCacheDir;         // where results of chunks are kept between runs (empty == off)
+    std::string           saveEvidenceFile;       // where the accumulated evidence of every record is written
+    std::string           loadEvidenceFile;       // evidence of an earlier run that the reads are added to
+
+    size_t scoreCacheSize = 65536; // alignment scores memoised per thread (0 disables)
+
+    bool   clusterAlignment = false; // align nearby variants jointly
+    size_t clusterSpan      = 300;   // maximum distance between the first and last variant of a cluster
+
+    bool passthrough = false; // copy input records verbatim and only append the FORMAT data
+
+    bool   sortInput      = false; // sort the input by coordinate before genotyping
+    bool   keepInputOrder = false; // with sortInput: write the output in input order
+    size_t sortMemory     = 1024;  // MiB of records kept in memory while sorting
+
+    size_t maxCellsPerVariant = 0; // DP cells that may be computed for a variant or cluster (0 == unlimited)
+
+    size_t planShards         = 8;   // lrcaller plan: number of shards to balance
+    double planCellsPerSecond = 1e9; // lrcaller plan: DP cells aligned per second and thread
 };
 
 inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
@@ -71,12 +98,20 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
     setDate(parser, __DATE__);
 
     addUsageLine(parser, "[\\fIOPTIONS\\fP]  \"\\fIBAMFILE\\fP\"  \"\\fIVCF_FILE_IN\\fP\" \"\\fIVCF_FILE_OUT\\fP\" ");
+    addUsageLine(parser,
+                 "plan [\\fIOPTIONS\\fP]  \"\\fIBAMFILE\\fP\"  \"\\fIVCF_FILE_IN\\fP\" \"\\fIPLAN_OUT\\fP\" ");
     addDescription(parser, "Genotypes variants using long reads\n in bam file/file of bam files ");
+    addDescription(parser,
+                   "With \"plan\", nothing is genotyped; instead, the runtime per number of threads, the peak "
+                   "memory and a balanced division into shards are estimated from the VCF file and the BAM indexes "
+                   "and written to PLAN_OUT.");
 
     addArgument(parser, seqan::ArgParseArgument(seqan::ArgParseArgument::STRING, "BAMFILE bam file/file of bam files"));
-    addArgument(parser, seqan::ArgParseArgument(seqan::ArgParseArgument::STRING, "VCF_FILE_IN - input vcf file"));
     addArgument(parser,
-                seqan::ArgParseArgument(seqan::ArgParseArgument::STRING, "VCF_FILE_OUT - output genotyped vcf file"));
+                seqan::ArgParseArgument(seqan::ArgParseArgument::STRING, "VCF_FILE_IN - input vcf file (- for stdin)"));
+    addArgument(parser,
+                seqan::ArgParseArgument(seqan::ArgParseArgument::STRING,
+                                        "VCF_FILE_OUT - output genotyped vcf file (- for stdout)"));
     addOption(parser, seqan::ArgParseOption("fa", "fa", "Fastafile", seqan::ArgParseArgument::STRING, "FA"));
     addOption(
       parser,
@@ -102,6 +137,11 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
                                     seqan::ArgParseArgument::STRING,
                                     "FAA"));
     addOption(parser, seqan::ArgParseOption("v", "verbose", "Verbose output"));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "trace",
+                                    "Like --verbose, and also trace every CIGAR operation. The messages about single "
+                                    "records and reads are only available in builds with LRCALLER_ENABLE_TRACE."));
     addOption(parser,
               seqan::ArgParseOption("rb",
                                     "right_breakpoint",
@@ -129,6 +169,47 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
     addOption(
       parser,
       seqan::ArgParseOption("", "cache-data-in-tmp", "Copy reads and index to (local) tmp directory before run."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "index-cache-dir",
+                                    "Keep the parsed BAM indexes in this directory, so that later runs on the same "
+                                    "BAM files can map them instead of parsing the .bai files.",
+                                    seqan::ArgParseArgument::STRING,
+                                    "DIR"));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "tile-index",
+                                    "Also store an index of the reads reaching into every 16 kb tile in the index "
+                                    "cache (built by reading each BAM file once), so that long reads ending before a "
+                                    "region are never decoded. Requires --index-cache-dir."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "prefetch",
+                                    "Before the reads of a chunk are fetched, let the kernel read the needed blocks of "
+                                    "all BAM files concurrently. Helps with many BAM files on high-latency storage."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "result-cache",
+                                    "Keep the results of every chunk of variants in this directory. Later runs take "
+                                    "chunks whose records, reference, BAM files and options are unchanged from there "
+                                    "instead of genotyping them again.",
+                                    seqan::ArgParseArgument::STRING,
+                                    "DIR"));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "save-evidence",
+                                    "Write the accumulated evidence of every record (likelihoods, allele depths and "
+                                    "read names) to this file.",
+                                    seqan::ArgParseArgument::STRING,
+                                    "FILE"));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "load-evidence",
+                                    "Add the reads to the evidence saved by an earlier run (e.g. on the previous BAM "
+                                    "files of the same sample) and genotype the combined evidence. Reads that were "
+                                    "already counted are skipped.",
+                                    seqan::ArgParseArgument::STRING,
+                                    "FILE"));
 
     addOption(
       parser,
@@ -165,6 +246,19 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
       parser,
       seqan::ArgParseOption("nt", "number_of_threads", "Number of threads", seqan::ArgParseArgument::INTEGER, "INT"));
     setDefaultValue(parser, "nt", O.nThreads);
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "pin-threads",
+                                    "Bind every thread to one CPU and allocate its buffers locally; improves scaling "
+                                    "on multi-socket (NUMA) machines."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "workers",
+                                    "Process the chunks in this many worker processes (each single-threaded) instead "
+                                    "of threads. A crashing worker only loses its current chunks, which are then "
+                                    "processed again. Overrides -nt.",
+                                    seqan::ArgParseArgument::INTEGER,
+                                    "INT"));
 
     addOption(parser,
               seqan::ArgParseOption("vw",
@@ -242,6 +336,76 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
                                     "INTEGER"));
     setDefaultValue(parser, "band", O.bandedAlignmentPercent);
 
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "score-cache-size",
+                                    "Number of alignment scores to memoise per thread (0 == no memoisation).",
+                                    seqan::ArgParseArgument::INTEGER,
+                                    "INTEGER"));
+    setDefaultValue(parser, "score-cache-size", O.scoreCacheSize);
+
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "max-cells-per-variant",
+                                    "Alignment matrix cells that may be computed for a variant (or cluster); beyond, "
+                                    "fewer reads are aligned, then with a narrower band, and finally none. Such "
+                                    "records are flagged with INFO/DEGRADED (0 == unlimited).",
+                                    seqan::ArgParseArgument::INT64,
+                                    "INTEGER"));
+    setDefaultValue(parser, "max-cells-per-variant", O.maxCellsPerVariant);
+
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "cluster-alignment",
+                                    "Align each read once against the local haplotypes of a cluster of nearby variants "
+                                    "instead of separately for every variant (left breakpoint only)."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "cluster-span",
+                                    "Maximum distance between the first and the last variant of a cluster.",
+                                    seqan::ArgParseArgument::INTEGER,
+                                    "INTEGER"));
+    setDefaultValue(parser, "cluster-span", O.clusterSpan);
+
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "passthrough",
+                                    "Copy the input records verbatim and only append the computed FORMAT fields; "
+                                    "faster on callsets with long sequences (uncompressed VCF input only)."));
+
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "sort-input",
+                                    "Sort the input VCF by coordinate before genotyping (needed for efficient "
+                                    "processing of unsorted input)."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "keep-input-order",
+                                    "With --sort-input: write the output records in the order of the input."));
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "sort-memory",
+                                    "Memory in MiB used for sorting; larger inputs are sorted via temporary files.",
+                                    seqan::ArgParseArgument::INTEGER,
+                                    "INTEGER"));
+    setDefaultValue(parser, "sort-memory", O.sortMemory);
+
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "plan-shards",
+                                    "lrcaller plan: number of shards of about equal cost to divide the input into.",
+                                    seqan::ArgParseArgument::INTEGER,
+                                    "INTEGER"));
+    setDefaultValue(parser, "plan-shards", O.planShards);
+    addOption(parser,
+              seqan::ArgParseOption("",
+                                    "plan-cells-per-second",
+                                    "lrcaller plan: alignment matrix cells computed per second and thread (measure "
+                                    "with a short run on the target machine for better estimates).",
+                                    seqan::ArgParseArgument::DOUBLE,
+                                    "DOUBLE"));
+    setDefaultValue(parser, "plan-cells-per-second", O.planCellsPerSecond);
+
     setDefaultValue(parser, "fa", O.faFile);
     setDefaultValue(parser, "b2", O.bam2);
     setValidValues(parser, "genotyper", "joint ad va multi");
@@ -268,6 +432,9 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
     if (isSet(parser, "number_of_threads"))
         getOptionValue(O.nThreads, parser, "number_of_threads");
 
+    if (isSet(parser, "workers"))
+        getOptionValue(O.workers, parser, "workers");
+
     if (isSet(parser, "var_window"))
         getOptionValue(O.varWindow, parser, "var_window");
 
@@ -311,6 +478,35 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
     if (isSet(parser, "band"))
         getOptionValue(O.bandedAlignmentPercent, parser, "band");
 
+    if (isSet(parser, "score-cache-size"))
+        getOptionValue(O.scoreCacheSize, parser, "score-cache-size");
+
+    if (isSet(parser, "max-cells-per-variant"))
+        getOptionValue(O.maxCellsPerVariant, parser, "max-cells-per-variant");
+
+    if (isSet(parser, "cluster-span"))
+        getOptionValue(O.clusterSpan, parser, "cluster-span");
+
+    if (isSet(parser, "sort-memory"))
+        getOptionValue(O.sortMemory, parser, "sort-memory");
+
+    if (isSet(parser, "plan-shards"))
+        getOptionValue(O.planShards, parser, "plan-shards");
+    if (isSet(parser, "plan-cells-per-second"))
+        getOptionValue(O.planCellsPerSecond, parser, "plan-cells-per-second");
+
+    if (isSet(parser, "index-cache-dir"))
+        getOptionValue(O.indexCacheDir, parser, "index-cache-dir");
+
+    if (isSet(parser, "result-cache"))
+        getOptionValue(O.resultCacheDir, parser, "result-cache");
+
+    if (isSet(parser, "save-evidence"))
+        getOptionValue(O.saveEvidenceFile, parser, "save-evidence");
+
+    if (isSet(parser, "load-evidence"))
+        getOptionValue(O.loadEvidenceFile, parser, "load-evidence");
+
     seqan::CharString gtModelName;
     if (isSet(parser, "genotyper"))
         getOptionValue(gtModelName, parser, "genotyper");
@@ -329,12 +525,20 @@ inline int parseLRCArguments(int argc, char const ** argv, LRCOptions & O)
     if (isSet(parser, "logScaleFactor"))
         getOptionValue(O.logScaleFactor, parser, "logScaleFactor");
     O.cropRead = isSet(parser, "cropread");
-    O.verbose                 = isSet(parser, "verbose");
+    O.verbose                 = isSet(parser, "verbose") || isSet(parser, "trace");
+    O.trace                   = isSet(parser, "trace");
     O.genotypeRightBreakpoint = isSet(parser, "right_breakpoint");
     O.outputRefAlt            = isSet(parser, "get_ref_alt");
     O.cacheDataInTmp          = isSet(parser, "cache-data-in-tmp");
     O.dynamicWSize            = isSet(parser, "dyn-w-size");
     O.mask                    = isSet(parser, "mask");
+    O.clusterAlignment        = isSet(parser, "cluster-alignment");
+    O.passthrough             = isSet(parser, "passthrough");
+    O.sortInput               = isSet(parser, "sort-input");
+    O.keepInputOrder          = isSet(parser, "keep-input-order");
+    O.tileIndex               = isSet(parser, "tile-index");
+    O.prefetch                = isSet(parser, "prefetch");
+    O.pinThreads              = isSet(parser, "pin-threads");
     // get options
     return res;
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "misc.hpp"
+
+/* Passthrough output
+ *
+ * LRcaller never changes the fixed columns of a record, but re-serialising seqan::VcfRecord writes all of them again,
+ * including multi-kilobase REF/ALT sequences and INFO fields of SV callsets. With --passthrough, the input lines are
+ * instead copied verbatim and only the FORMAT keys and the values computed for the first sample are spliced in.
+ * This requires reading the (uncompressed) input a second time, in lockstep with the parsed records.
+ */
+
+// Copies the header of the raw input, inserting the given meta-information lines before the #CHROM line
+inline void copyPassthroughHeader(std::istream &                   rawIn,
+                                  std::ostream &                   out,
+                                  std::vector<std::string> const & extraMetaLines)
+{
+    std::string line;
+    while (std::getline(rawIn, line))
+    {
+        if (line.starts_with("#CHROM"))
+        {
+            for (std::string const & meta : extraMetaLines)
+                out << meta << '\n';
+
+            // writePassthroughRecord() adds the columns that are missing
+            out << line;
+            if (ptrdiff_t const nTabs = std::ranges::count(line, '\t'); nTabs < 8) // no FORMAT and sample columns
+                out << "\tFORMAT\tSAMPLE";
+            else if (nTabs == 8) // FORMAT column, but no sample
+                out << "\tSAMPLE";
+            out << '\n';
+            return;
+        }
+
+        out << line << '\n';
+    }
+
+    throw error{"No #CHROM line found in the VCF header."};
+}
+
+// Reads the next record line of the raw input (seqan skips empty lines, too)
+inline void nextPassthroughRecord(std::istream & rawIn, std::string & line)
+{
+    while (std::getline(rawIn, line))
+        if (!line.empty() && line[0] != '#')
+            return;
+
+    throw error{"Input VCF ended unexpectedly while copying records."};
+}
+
+/* Writes the raw record line with formatKeys (":KEY1:KEY2") appended to the FORMAT column and sampleValues
+ * (":VAL1:VAL2") appended to the first sample column; both columns are added if the line has none. A non-empty
+ * infoEntry ("KEY=VALUE") is appended to the INFO column.
+ */
+inline void writePassthroughRecord(std::ostream &         out,
+                                   std::string_view const line,
+                                   std::string_view const formatKeys,
+                                   std::string_view const sampleValues,
+                                   std::string_view const infoEntry = {})
+{
+    // ends of the INFO column, the FORMAT column and the first sample column
+    size_t infoEnd   = line.size();
+    size_t formatEnd = line.size();
+    size_t sampleEnd = line.size();
+    size_t nTabs     = 0;
+    for (size_t i = 0; i < line.size() && nTabs < 10; ++i)
+    {
+        if (line[i] == '\t')
+        {
+            ++nTabs;
+            if (nTabs == 8)
+                infoEnd = i;
+            else if (nTabs == 9)
+                formatEnd = i;
+            else if (nTabs == 10)
+                sampleEnd = i;
+        }
+    }
+
+    if (nTabs < 7)
+        throw error{"Malformed VCF record line: ", std::string{line.substr(0, 100)}};
+
+    if (infoEntry.empty())
+    {
+        out << line.substr(0, infoEnd);
+    }
+    else
+    {
+        size_t const           infoBegin = line.rfind('\t', infoEnd - 1) + 1;
+        std::string_view const info      = line.substr(infoBegin, infoEnd - infoBegin);
+        out << line.substr(0, infoBegin);
+        if (!info.empty() && info != ".")
+            out << info << ';';
+        out << infoEntry;
+    }
+
+    if (nTabs == 7) // no FORMAT column
+    {
+        out << '\t' << formatKeys.substr(1) << '\t' << sampleValues.substr(1) << '\n';
+        return;
+    }
+
+    out << line.substr(infoEnd, formatEnd - infoEnd) << formatKeys;
+    if (nTabs == 8) // FORMAT column, but no sample
+        out << "\t." << sampleValues;
+    else
+        out << line.substr(formatEnd, sampleEnd - formatEnd) << sampleValues << line.substr(sampleEnd);
+    out << '\n';
+}
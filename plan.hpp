@@ -0,0 +1,429 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <seqan/bam_io.h>
+#include <seqan/seq_io.h>
+#include <seqan/vcf_io.h>
+
+#include "algo.hpp"
+#include "bai.hpp"
+#include "contig_table.hpp"
+#include "index_cache.hpp"
+#include "misc.hpp"
+#include "options.hpp"
+
+/* Dry-run planning (lrcaller plan)
+ *
+ * Estimates the cost of a run from the VCF file and the BAM indexes alone, without decoding any reads. The records
+ * are split into the same chunks as in mainProgram(); the reads of every chunk and variant are estimated from the
+ * sizes of the overlapping index bins, and the DP cells from wSizeActual and the number of alleles. The estimates are
+ * coarse (score cache hits and merged co-located records are not accounted for), but good enough to choose the
+ * number of threads, the memory request and the shards of a scheduler job.
+ */
+
+inline constexpr double PLAN_DECODE_BYTES_PER_SECOND = 100e6;   // compressed BAM bytes decoded per thread
+inline constexpr double PLAN_READ_MEMORY_FACTOR      = 4.0;     // memory of decoded reads per compressed byte
+inline constexpr double PLAN_VCF_RECORD_OVERHEAD     = 256;     // bytes of a seqan::VcfRecord besides its strings
+inline constexpr double PLAN_BAM_FILE_MEMORY         = 1 << 20; // buffers of an open BAM file
+inline constexpr double PLAN_SCORE_CACHE_ENTRY       = 48;      // bytes per memoised alignment score
+
+// Estimated cost of one chunk
+struct chunk_estimate
+{
+    int32_t rID      = 0;
+    int32_t first    = 0; // positions of the first and the last record
+    int32_t last     = 0;
+    size_t  nRecords = 0;
+
+    double bytes        = 0; // compressed BAM bytes decoded
+    double reads        = 0; // reads fetched
+    double cells        = 0; // DP cells of all alignments
+    double seconds      = 0; // on one thread
+    double recordMemory = 0; // of the VCF records and their output
+};
+
+// Length of the region covered by a BAI bin
+inline double binSpan(uint32_t const bin)
+{
+    if (bin == 0)
+        return 1 << 29;
+    if (bin < 9)
+        return 1 << 26;
+    if (bin < 73)
+        return 1 << 23;
+    if (bin < 585)
+        return 1 << 20;
+    if (bin < 4681)
+        return 1 << 17;
+    return 1 << 14;
+}
+
+// Approximate number of compressed bytes between two virtual offsets
+inline double virtualDistance(uint64_t const begin, uint64_t const end)
+{
+    double const blocks = static_cast<double>(end >> 16) - static_cast<double>(begin >> 16);
+    double const within = (static_cast<double>(end & 0xFFFF) - static_cast<double>(begin & 0xFFFF)) / 3.0;
+    return std::max(0.0, blocks + within);
+}
+
+/* Compressed bytes of the reads that overlap [begin, end). The share of the reads of a bin that overlap the region is
+ * estimated assuming reads of half the bin span.
+ */
+inline double estimateRegionBytes(bai_contig const & c, int32_t const begin, int32_t const end)
+{
+    double bytes = 0;
+    for (uint32_t const bin : reg2bins(std::max(begin, 0), std::max(end, 1)))
+    {
+        double const span     = binSpan(bin);
+        double const fraction = std::min(1.0, (end - begin + span / 2) / span);
+        for (bai_chunk const & chunk : c.binChunks(bin))
+            bytes += virtualDistance(chunk.begin, chunk.end) * fraction;
+    }
+    return bytes;
+}
+
+class plan_estimator
+{
+public:
+    plan_estimator(std::vector<bai_index> const & bamIndexes, contig_table const & contigs, LRCOptions const & O) :
+      bamIndexes{bamIndexes}, contigs{contigs}, O{O}, density(bamIndexes.size())
+    {}
+
+    chunk_estimate estimate(std::span<seqan::VcfRecord> records)
+    {
+        size_t const  wSizeActual = getWSizeActual(records, O);
+        int32_t const rID         = records.front().rID;
+        auto const [begin, end]   = chunkInterval(records, wSizeActual, O);
+
+        std::vector<double> varReads(records.size()); // reads overlapping the window of every variant
+
+        chunk_estimate est;
+        est.rID      = rID;
+        est.first    = records.front().beginPos;
+        est.last     = records.back().beginPos;
+        est.nRecords = records.size();
+
+        for (size_t i = 0; i < bamIndexes.size(); ++i)
+        {
+            uint32_t const bamRID = contigs.bamId(rID, i);
+            if (bamRID == NO_CONTIG || bamRID >= bamIndexes[i].size())
+                continue;
+
+            bai_contig const & c            = bamIndexes[i].contig(bamRID);
+            double const       readsPerByte = readDensity(i, bamRID);
+            double const       bytes        = estimateRegionBytes(c, begin, end);
+            est.bytes += bytes;
+            est.reads += bytes * readsPerByte;
+
+            for (size_t v = 0; v < records.size(); ++v)
+            {
+                int32_t const pos = records[v].beginPos;
+                varReads[v] += estimateRegionBytes(c,
+                                                   pos - (int32_t)wSizeActual,
+                                                   pos + (int32_t)length(records[v].ref) + (int32_t)wSizeActual) *
+                               readsPerByte;
+            }
+        }
+
+        // reads are cropped to about 4 * wSizeActual and aligned in a band against haplotypes of 2 * wSizeActual
+        double const band     = std::min<double>(O.bandedAlignmentPercent, 100.0) / 100.0;
+        double const hapLen   = 2.0 * wSizeActual;
+        double const readLen  = 4.0 * wSizeActual;
+        double const pairCost = std::min(readLen * hapLen, std::min(readLen, hapLen) * (readLen + hapLen) * band);
+
+        for (size_t v = 0; v < records.size(); ++v)
+        {
+            seqan::VcfRecord const & var = records[v];
+            est.recordMemory += 2 * (length(var.id) + length(var.ref) + length(var.alt) + length(var.info)) +
+                                PLAN_VCF_RECORD_OVERHEAD;
+
+            if (contigs.faiId(rID) == NO_CONTIG) // reads are counted, but not aligned
+                continue;
+
+            double nHaps = 2; // reference and first alternative
+            for (size_t i = 0; i < length(var.alt); ++i)
+                nHaps += var.alt[i] == ',';
+            double const cells = std::min(varReads[v], static_cast<double>(O.maxBARcount)) * nHaps * pairCost;
+            est.cells += O.maxCellsPerVariant > 0 ? std::min(cells, static_cast<double>(O.maxCellsPerVariant)) : cells;
+        }
+
+        est.seconds = est.bytes / PLAN_DECODE_BYTES_PER_SECOND + est.cells / O.planCellsPerSecond;
+        return est;
+    }
+
+private:
+    std::vector<bai_index> const &   bamIndexes;
+    contig_table const &             contigs;
+    LRCOptions const &               O;
+    std::vector<std::vector<double>> density; // reads per compressed byte, by BAM file and BAM contig
+
+    double readDensity(size_t const bam, uint32_t const bamRID)
+    {
+        std::vector<double> & d = density[bam];
+        if (d.empty())
+            d.resize(bamIndexes[bam].size(), -1);
+
+        if (d[bamRID] < 0)
+        {
+            bai_contig const & c     = bamIndexes[bam].contig(bamRID);
+            double             bytes = 0;
+            for (bai_chunk const & chunk : c.chunks)
+                bytes += virtualDistance(chunk.begin, chunk.end);
+            d[bamRID] = bytes > 0 ? c.nMapped / bytes : 0;
+        }
+
+        return d[bamRID];
+    }
+};
+
+// Calls callback(first, last) for the batches of chunks that mainProgram() processes with nThreads
+inline void forEachBatch(std::vector<chunk_estimate> const &          chunks,
+                         size_t const                                 nThreads,
+                         std::function<void(size_t, size_t)> const & callback)
+{
+    size_t const batchChunks  = 16 * nThreads;
+    size_t const batchRecords = 1024 * nThreads;
+
+    for (size_t first = 0; first < chunks.size();)
+    {
+        size_t last     = first;
+        size_t nRecords = 0;
+        while (last < chunks.size() && last - first < batchChunks && (last == first || nRecords < batchRecords))
+            nRecords += chunks[last++].nRecords;
+
+        callback(first, last);
+        first = last;
+    }
+}
+
+// Wall time with nThreads; the chunks of a batch are divided into contiguous blocks (static schedule)
+inline double estimateWallTime(std::vector<chunk_estimate> const & chunks, size_t const nThreads)
+{
+    double total = 0;
+    forEachBatch(chunks,
+                 nThreads,
+                 [&](size_t const first, size_t const last)
+                 {
+                     size_t const n         = last - first;
+                     double       batchTime = 0;
+                     for (size_t t = 0, c = first; t < nThreads && c < last; ++t)
+                     {
+                         double threadTime = 0;
+                         for (size_t const end = c + n / nThreads + (t < n % nThreads); c < end; ++c)
+                             threadTime += chunks[c].seconds;
+                         batchTime = std::max(batchTime, threadTime);
+                     }
+                     total += batchTime;
+                 });
+    return total;
+}
+
+// Peak memory with nThreads: indexes, per-thread state, the largest chunks' reads and the largest batch of records
+inline double estimatePeakMemory(std::vector<chunk_estimate> const & chunks,
+                                 size_t const                        nThreads,
+                                 size_t const                        nBams,
+                                 double const                        indexBytes,
+                                 LRCOptions const &                  O)
+{
+    std::vector<double> readMemory;
+    readMemory.reserve(chunks.size());
+    for (chunk_estimate const & c : chunks)
+        readMemory.push_back(c.bytes * PLAN_READ_MEMORY_FACTOR);
+    size_t const nLargest = std::min(nThreads, readMemory.size());
+    std::ranges::partial_sort(readMemory, readMemory.begin() + nLargest, std::greater{});
+
+    double reads = 0;
+    for (size_t i = 0; i < nLargest; ++i)
+        reads += readMemory[i];
+
+    double batch = 0;
+    forEachBatch(chunks,
+                 nThreads,
+                 [&](size_t const first, size_t const last)
+                 {
+                     double records = 0;
+                     for (size_t c = first; c < last; ++c)
+                         records += chunks[c].recordMemory;
+                     batch = std::max(batch, records);
+                 });
+
+    double const perThread = nBams * PLAN_BAM_FILE_MEMORY + O.scoreCacheSize * PLAN_SCORE_CACHE_ENTRY;
+    return indexBytes + nThreads * perThread + reads + batch;
+}
+
+// Divides the chunks into nShards contiguous shards of about equal cost; returns the first chunk of every shard
+inline std::vector<size_t> planShards(std::vector<chunk_estimate> const & chunks, size_t const nShards)
+{
+    double total = 0;
+    for (chunk_estimate const & c : chunks)
+        total += c.seconds;
+
+    std::vector<size_t> firsts{0};
+    double              sum = 0;
+    for (size_t i = 0; i + 1 < chunks.size() && firsts.size() < nShards; ++i)
+    {
+        sum += total > 0 ? chunks[i].seconds : 1;
+        if (sum >= (total > 0 ? total : chunks.size()) * firsts.size() / nShards)
+            firsts.push_back(i + 1);
+    }
+    return firsts;
+}
+
+template <typename TNameStore>
+inline void writePlan(std::ostream &                      out,
+                      std::vector<chunk_estimate> const & chunks,
+                      TNameStore const &                  contigNames,
+                      size_t const                        nBams,
+                      double const                        indexBytes,
+                      LRCOptions const &                  O)
+{
+    chunk_estimate total;
+    for (chunk_estimate const & c : chunks)
+    {
+        total.nRecords += c.nRecords;
+        total.bytes += c.bytes;
+        total.reads += c.reads;
+        total.cells += c.cells;
+        total.seconds += c.seconds;
+    }
+
+    out << std::setprecision(3);
+    out << "# lrcaller plan (estimates from the VCF file and the BAM indexes)\n"
+        << "records\t" << total.nRecords << '\n'
+        << "chunks\t" << chunks.size() << '\n'
+        << "bam_files\t" << nBams << '\n'
+        << "reads_fetched\t" << total.reads << '\n'
+        << "bam_mib_decoded\t" << total.bytes / (1 << 20) << '\n'
+        << "dp_cells\t" << total.cells << '\n'
+        << "cpu_seconds\t" << total.seconds << '\n';
+
+    std::vector<size_t> threadCounts;
+    for (size_t t = 1; t < O.nThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(std::max<size_t>(O.nThreads, 1));
+
+    double const serial = estimateWallTime(chunks, 1);
+    out << "\n# threads\twall_seconds\tspeedup\tpeak_rss_mib\n";
+    for (size_t const t : threadCounts)
+    {
+        double const wall = estimateWallTime(chunks, t);
+        out << t << '\t' << wall << '\t' << (wall > 0 ? serial / wall : 1.0) << '\t'
+            << estimatePeakMemory(chunks, t, nBams, indexBytes, O) / (1 << 20) << '\n';
+    }
+
+    // regions are POS ranges (1-based, inclusive) of the records of every shard
+    std::vector<size_t> firsts = planShards(chunks, std::max<size_t>(O.planShards, 1));
+    firsts.push_back(chunks.size());
+
+    out << "\n# shard\trecords\tcpu_seconds\tregions\n";
+    for (size_t s = 0; s + 1 < firsts.size(); ++s)
+    {
+        size_t      records = 0;
+        double      seconds = 0;
+        std::string regions;
+        for (size_t c = firsts[s]; c < firsts[s + 1];)
+        {
+            // consecutive chunks of a contig form one region
+            size_t last = c;
+            while (last + 1 < firsts[s + 1] && chunks[last + 1].rID == chunks[c].rID &&
+                   chunks[last + 1].first >= chunks[last].last)
+                ++last;
+
+            if (!regions.empty())
+                regions += ',';
+            regions += seqan::toCString(contigNames[chunks[c].rID]);
+            regions += ':' + std::to_string(chunks[c].first + 1) + '-' + std::to_string(chunks[last].last + 1);
+
+            for (; c <= last; ++c)
+            {
+                records += chunks[c].nRecords;
+                seconds += chunks[c].seconds;
+            }
+        }
+        out << s + 1 << '\t' << records << '\t' << seconds << '\t' << regions << '\n';
+    }
+}
+
+// lrcaller plan: estimates runtime, memory and shards without decoding reads
+inline void planProgram(LRCOptions O)
+{
+    O.cacheDataInTmp = false; // the BAM files are not read
+    O.tileIndex      = false; // building it decodes all reads; a tile index in the index cache is still used
+
+    seqan::VcfFileIn vcfIn;
+    if (O.vcfInFile == "-")
+    {
+        if (!open(vcfIn, std::cin, seqan::Vcf()))
+            throw error{"Could not read VCF from stdin."};
+    }
+    else if (!open(vcfIn, O.vcfInFile.c_str()))
+    {
+        throw error{"Could not open ", O.vcfInFile, " for reading."};
+    }
+
+    seqan::VcfHeader header;
+    readHeader(header, vcfIn);
+
+    // only the headers of the BAM files are read, for the names of their contigs
+    std::vector<std::filesystem::path> const bamPaths = parseBamFileName(O.bam, O);
+    size_t const                             nBams    = bamPaths.size();
+    std::vector<seqan::BamFileIn>            bamFiles(nBams);
+    std::vector<bai_index>                   bamIndexes(nBams);
+    double                                   indexBytes = 0;
+    for (size_t i = 0; i < nBams; ++i)
+    {
+        initializeBam(bamPaths[i], bamFiles[i]);
+        openBamIndex(bamIndexes[i], bamPaths[i], O);
+        indexBytes += std::filesystem::file_size(std::filesystem::path{bamPaths[i]} += ".bai");
+    }
+
+    seqan::FaiIndex faIndex;
+    if (!open(faIndex, O.faFile.c_str()) && !build(faIndex, O.faFile.c_str()))
+        throw error{"Could neither find nor build the index of ", O.faFile};
+
+    contig_table contigs{nBams};
+    contigs.update(seqan::contigNames(seqan::context(vcfIn)), faIndex, bamFiles);
+
+    plan_estimator                estimator{bamIndexes, contigs, O};
+    std::vector<chunk_estimate>   chunks;
+    std::vector<seqan::VcfRecord> chunk;
+    for (size_t nRead = 0; !atEnd(vcfIn); ++nRead)
+    {
+        seqan::VcfRecord r;
+        readRecord(r, vcfIn);
+        if (r.rID == -1)
+            throw error{"Invalid ID in VCF record number: ", nRead};
+        if ((size_t)r.rID >= contigs.size())
+            contigs.update(seqan::contigNames(seqan::context(vcfIn)), faIndex, bamFiles);
+
+        if (!chunk.empty() && startsNewChunk(chunk.back(), r, O))
+        {
+            chunks.push_back(estimator.estimate(chunk));
+            chunk.clear();
+        }
+        chunk.push_back(std::move(r));
+    }
+    if (!chunk.empty())
+        chunks.push_back(estimator.estimate(chunk));
+
+    std::ofstream  planFileStream;
+    std::ostream & planStream = O.vcfOutFile == "-" ? std::cout : planFileStream;
+    if (O.vcfOutFile != "-")
+    {
+        planFileStream.open(O.vcfOutFile);
+        if (!planFileStream)
+            throw error{"Could not open ", O.vcfOutFile, " for writing."};
+    }
+
+    writePlan(planStream, chunks, seqan::contigNames(seqan::context(vcfIn)), nBams, indexBytes, O);
+}
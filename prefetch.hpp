@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bai.hpp"
+#include "contig_table.hpp"
+
+/* Read-ahead of BAM blocks (--prefetch)
+ *
+ * processChunk() fetches the reads of a chunk from one BAM file after the other with blocking reads, so with many BAM
+ * files every thread waits for one request at a time. With --prefetch, the byte ranges that will be read from all BAM
+ * files are first announced to the kernel (posix_fadvise(POSIX_FADV_WILLNEED)), which reads them asynchronously and
+ * concurrently; the fetches then mostly hit the page cache. Without the option, or if a file cannot be opened, the
+ * reads are simply not announced.
+ */
+
+inline constexpr uint64_t PREFETCH_MAX_BYTES = 16 << 20; // per BAM file and chunk
+
+class bam_prefetcher
+{
+public:
+    bam_prefetcher() = default;
+    bam_prefetcher(bam_prefetcher const &) = delete;
+    bam_prefetcher & operator=(bam_prefetcher const &) = delete;
+
+    ~bam_prefetcher()
+    {
+        for (int const fd : fds)
+            if (fd >= 0)
+                ::close(fd);
+    }
+
+    void open(std::vector<std::filesystem::path> const & bamPaths)
+    {
+        for (std::filesystem::path const & path : bamPaths)
+            fds.push_back(::open(path.c_str(), O_RDONLY));
+    }
+
+    // Announces the blocks that fetchRecords() will read for [begin, end) of VCF contig rID from every BAM file
+    void prefetchRegion(std::vector<bai_index> const & bamIndexes,
+                        contig_table const &           contigs,
+                        int32_t const                  rID,
+                        int32_t const                  begin,
+                        int32_t const                  end) const
+    {
+        for (size_t i = 0; i < fds.size(); ++i)
+        {
+            uint32_t const bamRID = contigs.bamId(rID, i);
+            if (fds[i] < 0 || bamRID == NO_CONTIG)
+                continue;
+
+            auto const [first, last] = regionFileRange(bamIndexes[i], bamRID, begin, end, PREFETCH_MAX_BYTES);
+            if (last > first)
+                posix_fadvise(fds[i], first, last - first, POSIX_FADV_WILLNEED);
+        }
+    }
+
+private:
+    std::vector<int> fds; // by BAM file; -1 if the file could not be opened
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include <seqan/seq_io.h>
+#include <seqan/vcf_io.h>
+
+#include "algo.hpp"
+#include "contig_table.hpp"
+#include "index_cache.hpp"
+#include "options.hpp"
+
+/* Result cache (--result-cache)
+ *
+ * Callsets change little between releases, but every release used to be genotyped from scratch. With --result-cache,
+ * the results of every chunk (the values of the first sample and the budget levels) are stored in a file named after
+ * a hash of everything they depend on: the genotyping options, the BAM files (size, timestamps and header, see
+ * indexCacheKey()), the relevant fields of the chunk's records and the reference sequence around them. A chunk whose
+ * key is found is not processed again. Chunks are the unit, because reads are fetched and the window size is chosen
+ * per chunk; a changed record only invalidates the chunk that contains it.
+ * Files are written to a temporary name and renamed, so concurrent runs may share a cache directory.
+ */
+
+inline constexpr uint64_t RESULT_CACHE_VERSION = 1; // changes whenever results of the same input change
+
+// Hashes the raw bytes of values (numbers and flags)
+template <typename... value_ts>
+inline uint64_t hashValues(uint64_t hash, value_ts const &... values)
+{
+    ((hash = fnv1a({reinterpret_cast<char const *>(&values), sizeof(values)}, hash)), ...);
+    return hash;
+}
+
+// Hash of all options that influence the results
+inline uint64_t resultOptionsHash(LRCOptions const & O)
+{
+    uint64_t hash = fnv1a(LRCALLER_VERSION);
+    hash          = hashValues(hash, RESULT_CACHE_VERSION, O.dynamicWSize, O.wSize, O.maxBARcount);
+    hash          = hashValues(hash, O.genotypeRightBreakpoint, O.logScaleFactor, O.bandedAlignmentPercent);
+    hash          = hashValues(hash, O.match, O.mismatch, O.gapOpen, O.gapExtend, O.mask, O.cropRead, O.outputRefAlt);
+    hash          = hashValues(hash, O.maxSoftClipped, O.maxAlignBits, O.overlapBits, O.varWindow);
+    hash          = hashValues(hash, O.maxReadLenForCropping, O.minMapQ, O.minDelIns, O.minPresent);
+    hash          = hashValues(hash, O.refThreshFraction, O.altThreshFraction, O.altThreshFractionMax, O.gtModel);
+    hash          = hashValues(hash, O.clusterAlignment, O.clusterSpan, O.maxCellsPerVariant);
+    return hash;
+}
+
+// Hash of the options and of the BAM files; the part of the key shared by all chunks of a run
+inline uint64_t resultRunHash(LRCOptions const & O, std::vector<std::filesystem::path> const & bamPaths)
+{
+    uint64_t hash = resultOptionsHash(O);
+    for (std::filesystem::path const & bamPath : bamPaths)
+    {
+        std::filesystem::path baiPath = bamPath;
+        baiPath += ".bai";
+        bai_cache_key const key = indexCacheKey(bamPath, baiPath);
+        hash                    = fnv1a({reinterpret_cast<char const *>(&key), sizeof(key)}, hash);
+    }
+    return hash;
+}
+
+// Key of a chunk: the run hash, the records' positions and alleles, and the reference sequence they are aligned to
+inline uint64_t resultChunkKey(uint64_t const              runHash,
+                               std::span<seqan::VcfRecord> vcfRecords,
+                               seqan::CharString const &   chrom,
+                               seqan::FaiIndex &           faIndex,
+                               uint32_t const              faiId,
+                               LRCOptions const &          O)
+{
+    auto const view = [](seqan::CharString const & s)
+    { return std::string_view{begin(s, seqan::Standard()), length(s)}; };
+
+    uint64_t hash         = fnv1a(view(chrom), runHash);
+    size_t   maxRefLength = 0;
+    for (seqan::VcfRecord const & var : vcfRecords)
+    {
+        hash         = hashValues(hash, var.beginPos);
+        hash         = fnv1a(view(var.ref), fnv1a(view(var.alt), fnv1a(view(var.info), hash)));
+        hash         = hashValues(hash, '\n');
+        maxRefLength = std::max<size_t>(maxRefLength, length(var.ref));
+    }
+
+    if (faiId != NO_CONTIG)
+    {
+        size_t const wSizeActual              = getWSizeActual(vcfRecords, O);
+        auto const [genome_begin, genome_end] = chunkInterval(vcfRecords, wSizeActual, O);
+
+        seqan::Dna5String reference;
+        readRegion(reference, faIndex, faiId, genome_begin, genome_end + maxRefLength);
+        for (seqan::Dna5 const base : reference)
+            hash = hashValues(hash, seqan::ordValue(base));
+    }
+    return hash;
+}
+
+class result_cache
+{
+public:
+    void open(std::filesystem::path directory, uint64_t const runHashValue)
+    {
+        dir     = std::move(directory);
+        runHash = runHashValue;
+        std::filesystem::create_directories(dir);
+    }
+
+    bool enabled() const { return !dir.empty(); }
+
+    uint64_t chunkKey(std::span<seqan::VcfRecord> vcfRecords,
+                      seqan::CharString const &   chrom,
+                      seqan::FaiIndex &           faIndex,
+                      uint32_t const              faiId,
+                      LRCOptions const &          O) const
+    {
+        return resultChunkKey(runHash, vcfRecords, chrom, faIndex, faiId, O);
+    }
+
+    std::optional<std::string> load(uint64_t const key)
+    {
+        std::ifstream in{file(key), std::ios::binary};
+        if (!in)
+        {
+            ++misses;
+            return std::nullopt;
+        }
+
+        std::string bytes{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+        ++hits;
+        return bytes;
+    }
+
+    // Failures to write are ignored; the chunk is just computed again next time
+    void store(uint64_t const key, std::string_view const bytes)
+    {
+        std::filesystem::path const path = file(key);
+        std::filesystem::path       tmp  = path;
+        tmp += ".tmp" + std::to_string(getpid()) + '.' + std::to_string(nextTmp++);
+
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        {
+            std::ofstream out{tmp, std::ios::binary};
+            out.write(bytes.data(), bytes.size());
+            if (!out)
+            {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+            std::filesystem::remove(tmp, ec);
+    }
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+
+private:
+    // files are spread over 256 subdirectories
+    std::filesystem::path file(uint64_t const key) const
+    {
+        char name[20];
+        std::snprintf(name,
+                      sizeof(name),
+                      "%02x/%016llx",
+                      static_cast<unsigned>(key >> 56),
+                      static_cast<unsigned long long>(key));
+        return dir / name;
+    }
+
+    std::filesystem::path dir;
+    uint64_t              runHash = 0;
+    std::atomic<size_t>   nextTmp{0};
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+#include <seqan/sequence.h>
+
+#include "align_kernel.hpp"
+
+/* Memoisation of alignment scores
+ *
+ * Co-located VCF records and reads with identical windows (unflagged PCR duplicates, the same molecule sequenced
+ * twice) lead to the same (read window, haplotype) pair being aligned more than once. Each thread keeps a cache of
+ * scores keyed by content hashes of both sequences and the alignment parameters.
+ */
+
+// 64-bit FNV-1a over the ranks of the sequence characters
+template <typename TSeq>
+uint64_t hashSequence(TSeq const & seq)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < seqan::length(seq); ++i)
+    {
+        h ^= seqan::ordValue(seq[i]);
+        h *= 1099511628211ull;
+    }
+    return h ^ seqan::length(seq);
+}
+
+struct score_cache_key
+{
+    uint64_t readHash;
+    uint64_t alleleHash;
+    int32_t  lowerDiag;
+    int32_t  upperDiag;
+    int32_t  minScore;
+
+    bool operator==(score_cache_key const &) const = default;
+};
+
+struct score_cache_key_hash
+{
+    size_t operator()(score_cache_key const & k) const
+    {
+        uint64_t h = k.readHash * 0x9E3779B97F4A7C15ull ^ k.alleleHash;
+        h ^= (static_cast<uint64_t>(static_cast<uint32_t>(k.lowerDiag)) << 32) | static_cast<uint32_t>(k.upperDiag);
+        h ^= static_cast<uint64_t>(static_cast<uint32_t>(k.minScore)) * 0xC2B2AE3D27D4EB4Full;
+        return h;
+    }
+};
+
+// Counted per read: a hit needs the scores against all haplotypes, otherwise the read is aligned again
+struct score_cache_stats
+{
+    size_t hits   = 0;
+    size_t misses = 0;
+
+    score_cache_stats & operator+=(score_cache_stats const & rhs)
+    {
+        hits += rhs.hits;
+        misses += rhs.misses;
+        return *this;
+    }
+};
+
+/* Bounded cache of alignment scores for one thread and one scoring scheme.
+ * Eviction is generational: when the current generation is full, it replaces the previous one. Entries found in the
+ * previous generation are promoted, so frequently used entries survive.
+ */
+class score_cache
+{
+public:
+    score_cache_stats stats;
+
+    score_cache() = default;
+
+    score_cache(size_t const maxEntries, alignment_scheme const & scheme) :
+      maxGenerationSize{maxEntries > 0 ? std::max<size_t>(maxEntries / 2, 1) : 0},
+      scheme{scheme}
+    {}
+
+    bool enabled() const
+    {
+        return maxGenerationSize > 0;
+    }
+
+    alignment_scheme const & scoringScheme() const
+    {
+        return scheme;
+    }
+
+    std::optional<int32_t> find(score_cache_key const & key)
+    {
+        if (auto it = current.find(key); it != current.end())
+            return it->second;
+
+        if (auto it = previous.find(key); it != previous.end())
+        {
+            int32_t const score = it->second;
+            insert(key, score);
+            return score;
+        }
+
+        return std::nullopt;
+    }
+
+    void insert(score_cache_key const & key, int32_t const score)
+    {
+        if (current.size() >= maxGenerationSize)
+        {
+            previous = std::move(current);
+            current.clear();
+        }
+        current[key] = score;
+    }
+
+private:
+    using TMap = std::unordered_map<score_cache_key, int32_t, score_cache_key_hash>;
+
+    size_t           maxGenerationSize = 0;
+    alignment_scheme scheme;
+    TMap             current;
+    TMap             previous;
+};
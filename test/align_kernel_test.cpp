@@ -0,0 +1,177 @@
+/* Compares the anti-diagonal kernel (align_kernel.hpp) with seqan::localAlignmentScore() as called by alignRead().
+ * The kernel and SeqAn are used interchangeably and share the score cache, so their scores must be identical for
+ * every band, scoring scheme and value type.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <seqan/align.h>
+#include <seqan/align_parallel.h>
+#include <seqan/sequence.h>
+
+#include "align_kernel.hpp"
+
+using TSequence = seqan::String<seqan::Dna5>;
+
+std::mt19937_64 rng{20240611};
+
+size_t uniform(size_t const lo, size_t const hi) // [lo, hi]
+{
+    return std::uniform_int_distribution<size_t>{lo, hi}(rng);
+}
+
+TSequence randomSequence(size_t const length)
+{
+    TSequence seq;
+    resize(seq, length);
+    for (size_t i = 0; i < length; ++i)
+        seq[i] = uniform(0, 99) == 0 ? 4 : uniform(0, 3); // some Ns
+    return seq;
+}
+
+// A copy of seq with substitutions and small insertions and deletions at the given rate (in percent)
+TSequence mutate(TSequence const & seq, size_t const rate)
+{
+    TSequence out;
+    for (size_t i = 0; i < length(seq); ++i)
+    {
+        if (uniform(1, 100) > rate)
+            appendValue(out, seq[i]);
+        else if (size_t const kind = uniform(0, 2); kind == 0)
+            appendValue(out, seqan::Dna5(uniform(0, 3)));
+        else if (kind == 1)
+            append(out, randomSequence(uniform(1, 8)));
+        else
+            i += uniform(0, 7);
+    }
+    if (empty(out))
+        appendValue(out, seq[0]);
+    return out;
+}
+
+int32_t seqanScore(TSequence const &        seqH,
+                   TSequence const &        seqV,
+                   alignment_scheme const & scheme,
+                   int32_t const            lowerDiag,
+                   int32_t const            upperDiag)
+{
+    // the same call as in alignRead(), but with 32-bit scores so that it cannot overflow
+    seqan::Score<int32_t, seqan::Simple> const score(scheme.match, scheme.mismatch, scheme.gapExtend, scheme.gapOpen);
+    seqan::ExecutionPolicy<seqan::Serial, seqan::Vectorial> execP;
+    std::vector<TSequence> const                            seqsH{seqH};
+    std::vector<TSequence> const                            seqsV{seqV};
+    return seqan::localAlignmentScore(execP, seqsH, seqsV, score, lowerDiag, upperDiag)[0];
+}
+
+size_t failures = 0;
+
+// Checks the kernel with TValue (or with the type antidiagonalLocalScore() chooses) against SeqAn
+template <typename TValue = void>
+void check(TSequence const &        seqH,
+           TSequence const &        seqV,
+           alignment_scheme const & scheme,
+           int32_t const            lowerDiag,
+           int32_t const            upperDiag)
+{
+    int32_t const expected  = seqanScore(seqH, seqV, scheme, lowerDiag, upperDiag);
+    char const *  valueType = std::is_same_v<TValue, int16_t>   ? "int16_t"
+                              : std::is_same_v<TValue, int32_t> ? "int32_t"
+                                                                : "chosen type";
+
+    auto kernel = [&](int32_t const minScore)
+    {
+        if constexpr (std::is_void_v<TValue>)
+            return antidiagonalLocalScore(seqH, seqV, scheme, lowerDiag, upperDiag, minScore);
+        else
+            return antidiagonalLocalScoreImpl<TValue>(seqH, seqV, scheme, lowerDiag, upperDiag, minScore);
+    };
+
+    // without a minimum, the exact score; with one, the exact score above it and std::nullopt otherwise
+    for (int32_t const minScore : {std::numeric_limits<int32_t>::lowest(), expected - 1, expected})
+    {
+        std::optional<int32_t> const score = kernel(minScore);
+        if (score == (expected > minScore ? std::optional<int32_t>{expected} : std::nullopt))
+            continue;
+
+        std::cerr << "MISMATCH: lengths " << length(seqH) << " x " << length(seqV) << ", band [" << lowerDiag
+                  << ", " << upperDiag << "], scheme " << scheme.match << '/' << scheme.mismatch << '/'
+                  << scheme.gapOpen << '/' << scheme.gapExtend << ", " << valueType << ", minScore " << minScore
+                  << ": SeqAn " << expected << ", kernel " << (score ? std::to_string(*score) : "none") << '\n';
+        ++failures;
+    }
+}
+
+int main()
+{
+    alignment_scheme const schemes[] = {
+      {1, -1, -1, -1}, // the defaults
+      {2, -3, -5, -1}, // affine gaps
+      {1, -4, -6, -2},
+      {10, -8, -12, -3}, // scores beyond int16_t for long sequences
+    };
+
+    // short pairs with all kinds of bands, for both value types
+    for (size_t round = 0; round < 200; ++round)
+    {
+        TSequence const hap  = randomSequence(uniform(1, 300));
+        TSequence const read = uniform(0, 4) == 0 ? randomSequence(uniform(1, 300)) : mutate(hap, uniform(0, 20));
+
+        int32_t const m = length(hap);
+        int32_t const n = length(read);
+        int32_t       lowerDiag, upperDiag;
+        switch (round % 4)
+        {
+            case 0: // everything
+                lowerDiag = -m;
+                upperDiag = n;
+                break;
+            case 1: // as in alignRead()
+                lowerDiag = -(int32_t)(m * 0.4);
+                upperDiag = n * 0.4;
+                break;
+            case 2: // narrow
+                lowerDiag = -(int32_t)uniform(0, 5);
+                upperDiag = uniform(0, 5);
+                break;
+            default: // anywhere in the matrix, often not containing the main diagonal
+                lowerDiag = (int32_t)uniform(0, m + n) - m;
+                upperDiag = std::min<int32_t>(lowerDiag + uniform(0, 40), n);
+        }
+
+        for (alignment_scheme const & scheme : schemes)
+        {
+            check<int16_t>(read, hap, scheme, lowerDiag, upperDiag);
+            check<int32_t>(read, hap, scheme, lowerDiag, upperDiag);
+        }
+    }
+
+    // pairs long enough for the kernel to be used (see selectAlignMode()); the last scheme needs int32_t
+    for (size_t round = 0; round < 12; ++round)
+    {
+        size_t const    minLength = INTRA_SEQ_MIN_LENGTH + 256; // stays above INTRA_SEQ_MIN_LENGTH when mutated
+        TSequence const hap       = randomSequence(uniform(minLength, 2 * minLength));
+        TSequence const read      = round % 4 == 3 ? randomSequence(uniform(minLength, 2 * minLength))
+                                                   : mutate(hap, uniform(1, 15));
+
+        int32_t const band = length(hap) * (round % 2 == 0 ? 0.4 : 0.05);
+        for (alignment_scheme const & scheme : schemes)
+            check(read, hap, scheme, -band, (int32_t)(length(read) * (round % 2 == 0 ? 0.4 : 0.05)));
+    }
+
+    if (failures > 0)
+    {
+        std::cerr << failures << " mismatch(es) between the alignment kernel and SeqAn.\n";
+        return EXIT_FAILURE;
+    }
+    std::cerr << "The alignment kernel matches SeqAn.\n";
+    return EXIT_SUCCESS;
+}
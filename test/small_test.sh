@@ -30,7 +30,10 @@ set -u
 # create MYTMP (THIS DOESNT WORK ON BSD AND MAC)
 MYTMP=$(mktemp -d)
 
-PROG="$1/lrcaller"
+# optional: name of the binary, a launcher (e.g. "mpirun -np 4") and "passthrough" to also test --passthrough
+PROG="$1/${2:-lrcaller}"
+LAUNCHER="${3:-}"
+PASSTHROUGH="${4:-}"
 if [ ! -x "$PROG" ]; then
     echo "ERROR: lrcaller binary not found/executable." >&2
     echo "--------------------------------------" >&2
@@ -46,7 +49,7 @@ fi
 
 echo "Test start."
 
-${PROG} -lsf 0.2 -w 100 -gtm ad -fa "${DATADIR}/chr1reg.fa" "${DATADIR}/reads.bam" "${DATADIR}/input.vcf" "${MYTMP}/output.vcf"
+${LAUNCHER} ${PROG} -lsf 0.2 -w 100 -gtm ad -fa "${DATADIR}/chr1reg.fa" "${DATADIR}/reads.bam" "${DATADIR}/input.vcf" "${MYTMP}/output.vcf"
 
 echo "Test done."
 
@@ -70,3 +73,29 @@ if [ "$CONTROL" != "$ACTUAL" ]; then
     exit 1
 fi
 
+if [ "$PASSTHROUGH" = "passthrough" ]; then
+    echo "Passthrough test start."
+
+    ${LAUNCHER} ${PROG} --passthrough -lsf 0.2 -w 100 -gtm ad -fa "${DATADIR}/chr1reg.fa" "${DATADIR}/reads.bam" "${DATADIR}/input.vcf" "${MYTMP}/output.passthrough.vcf"
+
+    echo "Passthrough test done."
+
+    # only the header is copied from the input; the records are the same
+    grep -v '^#' "${MYTMP}/output.vcf" > "${MYTMP}/records.vcf"
+    grep -v '^#' "${MYTMP}/output.passthrough.vcf" > "${MYTMP}/records.passthrough.vcf"
+    if ! cmp -s "${MYTMP}/records.vcf" "${MYTMP}/records.passthrough.vcf"; then
+        echo "Records written with --passthrough are not as expected."
+        echo "DIFF:"
+        diff -u "${MYTMP}/records.vcf" "${MYTMP}/records.passthrough.vcf"
+        exit 1
+    fi
+
+    # an input with a FORMAT column, but no sample: the header needs to declare the sample column that is added
+    ${LAUNCHER} ${PROG} --passthrough -lsf 0.2 -w 100 -gtm ad -fa "${DATADIR}/chr1reg.fa" "${DATADIR}/reads.bam" "${DATADIR}/input_format_no_samples.vcf" "${MYTMP}/output.no_samples.vcf"
+
+    if ! awk -F '\t' '/^#CHROM/ { n = NF } !/^#/ && NF != n { exit 1 }' "${MYTMP}/output.no_samples.vcf"; then
+        echo "Records written with --passthrough have more columns than the header declares."
+        grep -m 2 -v '^##' "${MYTMP}/output.no_samples.vcf"
+        exit 1
+    fi
+fi
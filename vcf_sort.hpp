@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <seqan/vcf_io.h>
+
+#include "misc.hpp"
+
+/* Out-of-core sorting of VCF records
+ *
+ * Unsorted input defeats the chunking in mainProgram(): every record becomes its own chunk and the same BAM regions
+ * are fetched over and over. With --sort-input, the records are sorted by (contig, position) into a temporary VCF
+ * first; with --keep-input-order, the genotyped records are afterwards sorted back into input order. Both sorts keep
+ * at most --sort-memory bytes of records in memory and spill sorted runs to disk otherwise.
+ */
+
+using extsort_key = std::array<uint64_t, 3>;
+
+// Sorts byte strings by key; stable if the key contains the input index
+class external_sorter
+{
+public:
+    external_sorter(std::filesystem::path dir, size_t const maxMemory) : dir{std::move(dir)}, maxMemory{maxMemory} {}
+
+    void push(extsort_key const & key, std::string_view const bytes)
+    {
+        entries.push_back({key, buffer.size(), bytes.size()});
+        buffer.append(bytes);
+
+        if (buffer.size() + entries.size() * sizeof(entry) >= maxMemory)
+            spill();
+    }
+
+    // Calls callback(key, bytes) for all entries in order of their keys
+    template <typename TCallback>
+    void merge(TCallback && callback)
+    {
+        if (runs.empty()) // everything fits into memory
+        {
+            sortEntries();
+            for (entry const & e : entries)
+                callback(e.key, std::string_view{buffer}.substr(e.offset, e.length));
+            clearEntries();
+            return;
+        }
+
+        spill();
+
+        // limit the number of files that are open at the same time
+        while (runs.size() > MAX_FAN_IN)
+        {
+            std::vector<std::filesystem::path> group(runs.begin(), runs.begin() + MAX_FAN_IN);
+            runs.erase(runs.begin(), runs.begin() + MAX_FAN_IN);
+
+            std::filesystem::path merged = nextRunPath();
+            std::ofstream         out{merged, std::ios::binary};
+            mergeRuns(group, [&](extsort_key const & key, std::string_view bytes) { writeEntry(out, key, bytes); });
+            if (!out.flush())
+                throw error{"Could not write temporary file ", merged.string()};
+            runs.push_back(std::move(merged));
+        }
+
+        mergeRuns(runs, callback);
+        runs.clear();
+    }
+
+private:
+    struct entry
+    {
+        extsort_key key;
+        size_t      offset;
+        size_t      length;
+    };
+
+    static constexpr size_t MAX_FAN_IN = 256;
+
+    std::filesystem::path              dir;
+    size_t                             maxMemory;
+    std::string                        buffer;
+    std::vector<entry>                 entries;
+    std::vector<std::filesystem::path> runs;
+    size_t                             nRunsCreated = 0;
+
+    std::filesystem::path nextRunPath()
+    {
+        return dir / ("run" + std::to_string(nRunsCreated++) + ".bin");
+    }
+
+    void sortEntries()
+    {
+        std::ranges::sort(entries, [](entry const & lhs, entry const & rhs) { return lhs.key < rhs.key; });
+    }
+
+    void clearEntries()
+    {
+        entries.clear();
+        buffer.clear();
+    }
+
+    static void writeEntry(std::ostream & out, extsort_key const & key, std::string_view const bytes)
+    {
+        uint64_t const length = bytes.size();
+        out.write(reinterpret_cast<char const *>(key.data()), sizeof(key));
+        out.write(reinterpret_cast<char const *>(&length), sizeof(length));
+        out.write(bytes.data(), bytes.size());
+    }
+
+    static bool readEntry(std::istream & in, extsort_key & key, std::string & bytes)
+    {
+        uint64_t length = 0;
+        if (!in.read(reinterpret_cast<char *>(key.data()), sizeof(key)))
+            return false;
+        in.read(reinterpret_cast<char *>(&length), sizeof(length));
+        bytes.resize(length);
+        in.read(bytes.data(), length);
+        return static_cast<bool>(in);
+    }
+
+    // Writes the current entries as a sorted run
+    void spill()
+    {
+        if (entries.empty())
+            return;
+
+        sortEntries();
+
+        std::filesystem::path run = nextRunPath();
+        std::ofstream         out{run, std::ios::binary};
+        for (entry const & e : entries)
+            writeEntry(out, e.key, std::string_view{buffer}.substr(e.offset, e.length));
+        if (!out.flush())
+            throw error{"Could not write temporary file ", run.string()};
+
+        runs.push_back(std::move(run));
+        clearEntries();
+    }
+
+    // k-way merge of sorted runs; the run files are removed afterwards
+    template <typename TCallback>
+    static void mergeRuns(std::vector<std::filesystem::path> const & paths, TCallback && callback)
+    {
+        struct head
+        {
+            extsort_key key;
+            size_t      run;
+        };
+        auto const greater = [](head const & lhs, head const & rhs)
+        { return lhs.key != rhs.key ? lhs.key > rhs.key : lhs.run > rhs.run; };
+
+        std::vector<std::ifstream> ins;
+        std::vector<std::string>   bytes(paths.size());
+        std::priority_queue<head, std::vector<head>, decltype(greater)> heads{greater};
+
+        ins.reserve(paths.size());
+        for (size_t r = 0; r < paths.size(); ++r)
+        {
+            ins.emplace_back(paths[r], std::ios::binary);
+            if (!ins.back())
+                throw error{"Could not read temporary file ", paths[r].string()};
+
+            extsort_key key;
+            if (readEntry(ins[r], key, bytes[r]))
+                heads.push({key, r});
+        }
+
+        while (!heads.empty())
+        {
+            head const h = heads.top();
+            heads.pop();
+            callback(h.key, std::string_view{bytes[h.run]});
+
+            extsort_key key;
+            if (readEntry(ins[h.run], key, bytes[h.run]))
+                heads.push({key, h.run});
+        }
+
+        ins.clear();
+        for (std::filesystem::path const & p : paths)
+            std::filesystem::remove(p);
+    }
+};
+
+/* Writes the records of vcfInFile sorted by (contig, position) to sortedFile; ties keep their input order.
+ * The input index of every record of the sorted file is written to indexFile.
+ */
+inline void sortVcf(std::string const &           vcfInFile,
+                    std::filesystem::path const & sortedFile,
+                    std::filesystem::path const & indexFile,
+                    std::filesystem::path const & tmpDir,
+                    size_t const                  maxMemory)
+{
+    seqan::VcfFileIn vcfIn;
+    if (vcfInFile == "-")
+    {
+        if (!open(vcfIn, std::cin, seqan::Vcf()))
+            throw error{"Could not read VCF from stdin."};
+    }
+    else if (!open(vcfIn, vcfInFile.c_str()))
+    {
+        throw error{"Could not open ", vcfInFile, " for reading."};
+    }
+
+    seqan::VcfHeader header;
+    readHeader(header, vcfIn);
+
+    external_sorter   sorter{tmpDir, maxMemory};
+    seqan::VcfRecord  record;
+    seqan::CharString line;
+    for (uint64_t i = 0; !atEnd(vcfIn); ++i)
+    {
+        readRecord(record, vcfIn);
+        if (record.rID == -1)
+            throw error{"Invalid ID in VCF record number: ", i};
+
+        clear(line);
+        writeRecord(line, record, seqan::context(vcfIn), seqan::Vcf());
+        sorter.push({static_cast<uint64_t>(record.rID), static_cast<uint64_t>(record.beginPos), i},
+                    std::string_view{begin(line, seqan::Standard()), length(line)});
+    }
+
+    // contigs that are not declared in the header are added in order of appearance, so they keep their IDs
+    seqan::CharString headerText;
+    writeHeader(headerText, header, seqan::context(vcfIn), seqan::Vcf());
+
+    std::ofstream sortedOut{sortedFile};
+    std::ofstream indexOut{indexFile, std::ios::binary};
+    sortedOut.write(begin(headerText, seqan::Standard()), length(headerText));
+
+    sorter.merge(
+      [&](extsort_key const & key, std::string_view const bytes)
+      {
+          sortedOut.write(bytes.data(), bytes.size());
+          indexOut.write(reinterpret_cast<char const *>(&key[2]), sizeof(key[2]));
+      });
+
+    if (!sortedOut.flush() || !indexOut.flush())
+        throw error{"Could not write temporary file in ", tmpDir.string()};
+}
+
+// Writes the genotyped records of sortedFile in the input order given by indexFile
+inline void restoreInputOrder(std::filesystem::path const & sortedFile,
+                              std::filesystem::path const & indexFile,
+                              std::ostream &                out,
+                              std::filesystem::path const & tmpDir,
+                              size_t const                  maxMemory)
+{
+    std::ifstream sortedIn{sortedFile};
+    std::ifstream indexIn{indexFile, std::ios::binary};
+
+    external_sorter sorter{tmpDir, maxMemory};
+    std::string     line;
+    while (std::getline(sortedIn, line))
+    {
+        if (line.empty())
+            continue;
+
+        if (line[0] == '#')
+        {
+            out << line << '\n';
+            continue;
+        }
+
+        uint64_t index = 0;
+        if (!indexIn.read(reinterpret_cast<char *>(&index), sizeof(index)))
+            throw error{"Record order of the input VCF could not be restored."};
+
+        line += '\n';
+        sorter.push({index, 0, 0}, line);
+    }
+
+    sorter.merge([&](extsort_key const &, std::string_view const bytes) { out.write(bytes.data(), bytes.size()); });
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "misc.hpp"
+
+/* Multi-process execution (--workers)
+ *
+ * Instead of OpenMP threads, the chunks of a batch are processed by forked worker processes. Everything the workers
+ * need (records, chunk list, contig table, reference and BAM indexes) is set up by the main process before the fork
+ * and shared copy-on-write; mapped index caches are shared anyway. Chunks are handed out through a counter in a shared
+ * anonymous mapping, so that workers take the next chunk when done with the last one. Every worker appends the results
+ * of its chunks to its own temporary file and records where they are; the main process reads them in chunk order once
+ * all workers have exited.
+ * A crashed worker only loses its unfinished chunks: these are given to newly forked workers, up to WORKER_ATTEMPTS
+ * times. A chunk that still fails (e.g. because it crashes every worker) is reported without genotypes.
+ */
+
+// Where the result of a task is; set by the worker that did it
+struct worker_task
+{
+    std::atomic<bool> done{false};
+    uint32_t          worker = 0;
+    uint64_t          offset = 0;
+    uint64_t          length = 0;
+};
+
+// Shared between the main process and the workers of one batch: the next task to take, followed by all tasks
+class worker_queue
+{
+public:
+    explicit worker_queue(size_t const nTasks) : bytes{sizeof(std::atomic<size_t>) + nTasks * sizeof(worker_task)}
+    {
+        map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+            throw error{"Could not map the worker queue: ", std::strerror(errno)};
+
+        new (map) std::atomic<size_t>{0};
+        for (size_t i = 0; i < nTasks; ++i)
+            new (&task(i)) worker_task{};
+    }
+    worker_queue(worker_queue const &) = delete;
+    worker_queue & operator=(worker_queue const &) = delete;
+    ~worker_queue() { munmap(map, bytes); }
+
+    size_t take() { return static_cast<std::atomic<size_t> *>(map)->fetch_add(1); }
+
+    worker_task & task(size_t const i)
+    {
+        return reinterpret_cast<worker_task *>(static_cast<char *>(map) + sizeof(std::atomic<size_t>))[i];
+    }
+
+private:
+    void * map;
+    size_t bytes;
+};
+
+// The temporary result file of one worker; removed from the file system right away
+class worker_file
+{
+public:
+    worker_file() : file{std::tmpfile()}
+    {
+        if (file == nullptr)
+            throw error{"Could not create a temporary file for worker results: ", std::strerror(errno)};
+    }
+    worker_file(worker_file const &) = delete;
+    worker_file & operator=(worker_file const &) = delete;
+    ~worker_file() { std::fclose(file); }
+
+    // Appends bytes (in a worker) and returns their offset
+    uint64_t append(std::string_view const bytes)
+    {
+        uint64_t const offset = end;
+        for (size_t done = 0; done < bytes.size();)
+        {
+            ssize_t const n = ::pwrite(fileno(file), bytes.data() + done, bytes.size() - done, end);
+            if (n <= 0)
+                throw error{"Could not write worker results: ", std::strerror(errno)};
+            done += n;
+            end += n;
+        }
+        return offset;
+    }
+
+    // Reads bytes written by a worker (in the main process)
+    void read(std::string & bytes, uint64_t const offset, uint64_t const length) const
+    {
+        bytes.resize(length);
+        for (size_t done = 0; done < length;)
+        {
+            ssize_t const n = ::pread(fileno(file), bytes.data() + done, length - done, offset + done);
+            if (n <= 0)
+                throw error{"Could not read worker results: ", std::strerror(errno)};
+            done += n;
+        }
+    }
+
+private:
+    FILE *   file;
+    uint64_t end = 0; // only used in the worker
+};
+
+// Number of workers a task is given to before it is given up
+inline constexpr size_t WORKER_ATTEMPTS = 3;
+
+/* Runs tasks in up to nWorkers forked processes and passes their results to receive(); returns the tasks without a
+ * (valid) result, because their worker failed or receive() rejected it.
+ */
+template <typename setup_t, typename work_t, typename receive_t>
+std::vector<size_t> runWorkerRound(std::vector<size_t> const & tasks,
+                                   size_t const                nWorkers,
+                                   setup_t &&                  setup,
+                                   work_t &&                   work,
+                                   receive_t &&                receive)
+{
+    worker_queue queue{tasks.size()};
+
+    std::vector<std::unique_ptr<worker_file>> files;
+    std::vector<pid_t>                        pids;
+    for (size_t w = 0; w < std::min(nWorkers, tasks.size()); ++w)
+    {
+        files.push_back(std::make_unique<worker_file>());
+
+        pid_t const pid = fork();
+        if (pid < 0)
+        {
+            std::cerr << "WARNING: Could not start worker " << w << ": " << std::strerror(errno) << '\n';
+            files.pop_back();
+            break;
+        }
+        if (pid == 0)
+        {
+            int status = 0;
+            try
+            {
+                setup();
+                for (size_t k; (k = queue.take()) < tasks.size();)
+                {
+                    std::string const result = work(tasks[k]);
+                    worker_task &     task   = queue.task(k);
+                    task.worker              = w;
+                    task.offset              = files[w]->append(result);
+                    task.length              = result.size();
+                    task.done.store(true, std::memory_order_release);
+                }
+            }
+            catch (std::exception const & e)
+            {
+                std::cerr << "ERROR in worker " << w << ": " << e.what() << '\n';
+                status = 1;
+            }
+            catch (...)
+            {
+                status = 1;
+            }
+            _exit(status); // the worker must not flush or destroy state it shares with the main process
+        }
+        pids.push_back(pid);
+    }
+
+    for (size_t w = 0; w < pids.size(); ++w)
+    {
+        int status = 0;
+        while (waitpid(pids[w], &status, 0) < 0 && errno == EINTR)
+        {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            std::cerr << "WARNING: Worker " << w << " failed; its unfinished chunks are given to a new worker.\n";
+    }
+
+    std::vector<size_t> failed;
+    std::string         result;
+    for (size_t k = 0; k < tasks.size(); ++k)
+    {
+        worker_task const & task = queue.task(k);
+        if (!task.done.load(std::memory_order_acquire))
+        {
+            failed.push_back(tasks[k]);
+            continue;
+        }
+
+        files[task.worker]->read(result, task.offset, task.length);
+        if (!receive(tasks[k], std::string_view{result}))
+        {
+            std::cerr << "WARNING: Worker " << task.worker << " returned an invalid result for chunk " << tasks[k]
+                      << "; it is given to a new worker.\n";
+            failed.push_back(tasks[k]);
+        }
+    }
+    return failed;
+}
+
+/* Processes tasks [0, nTasks) in nWorkers forked processes.
+ *  - setup() runs once in every worker, before the first task (e.g. to reopen files, whose offsets would otherwise
+ *    be shared with the other processes);
+ *  - work(i) runs in a worker and returns the result of task i as bytes;
+ *  - receive(i, bytes) runs in the main process, once per task and in any order; it returns false if bytes are not
+ *    a valid result of task i;
+ *  - fail(i) runs in the main process for tasks without a valid result after WORKER_ATTEMPTS workers.
+ * The work is never done by the main process, so a task that crashes its worker every time cannot end the run.
+ */
+template <typename setup_t, typename work_t, typename receive_t, typename fail_t>
+void runInWorkers(size_t const nTasks,
+                  size_t const nWorkers,
+                  setup_t &&   setup,
+                  work_t &&    work,
+                  receive_t && receive,
+                  fail_t &&    fail)
+{
+    std::vector<size_t> pending(nTasks);
+    for (size_t i = 0; i < nTasks; ++i)
+        pending[i] = i;
+
+    for (size_t attempt = 0; attempt < WORKER_ATTEMPTS && !pending.empty(); ++attempt)
+        pending = runWorkerRound(pending, nWorkers, setup, work, receive);
+
+    for (size_t const i : pending)
+        fail(i);
+}